@@ -0,0 +1,246 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <functional>
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Minimal native benchmark harness for the SerialCommandManager benchmarks.
+ *
+ * Accepts the Google Benchmark flags the suite needs (--benchmark_filter, --benchmark_min_time,
+ * --benchmark_format, --benchmark_out) and writes the same JSON layout, so results can be compared
+ * with Google Benchmark's tools/compare.py without the library being a build dependency.
+ */
+
+/**
+ * @brief Passed to each benchmark body, which runs its operation iterations() times.
+ */
+class BenchState
+{
+public:
+    explicit BenchState(uint64_t iterations) : _iterations(iterations) {}
+
+    uint64_t iterations() const { return _iterations; }
+
+    /**
+     * @brief Reports the items (messages, frames) handled by the run, shown as items_per_second.
+     */
+    void setItemsProcessed(uint64_t items) { _items = items; }
+
+    /**
+     * @brief Reports the bytes handled by the run, shown as bytes_per_second.
+     */
+    void setBytesProcessed(uint64_t bytes) { _bytes = bytes; }
+
+    uint64_t itemsProcessed() const { return _items; }
+    uint64_t bytesProcessed() const { return _bytes; }
+
+private:
+    uint64_t _iterations;
+    uint64_t _items = 0;
+    uint64_t _bytes = 0;
+};
+
+struct BenchResult
+{
+    std::string name;
+    uint64_t iterations;
+    double realNanos;       // wall time per iteration
+    double cpuNanos;        // process CPU time per iteration
+    double itemsPerSecond;
+    double bytesPerSecond;
+};
+
+class Bench
+{
+public:
+    typedef std::function<void(BenchState&)> Body;
+
+    /**
+     * @brief Registers a benchmark, names follow Google Benchmark's Family/arg:value convention.
+     */
+    static void add(const std::string& name, Body body)
+    {
+        benchmarks().push_back({ name, body });
+    }
+
+    /**
+     * @brief Runs the registered benchmarks matching the filter and prints the results.
+     * @return Process exit code.
+     */
+    static int run(int argc, char** argv)
+    {
+        std::string filter = ".";
+        std::string format = "console";
+        std::string outPath;
+        double minTime = 0.5;
+
+        for (int i = 1; i < argc; i++)
+        {
+            const char* arg = argv[i];
+
+            if (const char* value = flag(arg, "--benchmark_filter="))
+                filter = value;
+            else if (const char* value = flag(arg, "--benchmark_min_time="))
+                minTime = atof(value);
+            else if (const char* value = flag(arg, "--benchmark_format="))
+                format = value;
+            else if (const char* value = flag(arg, "--benchmark_out="))
+                outPath = value;
+            else
+            {
+                fprintf(stderr, "usage: %s [--benchmark_filter=<regex>] [--benchmark_min_time=<s>]\n"
+                                "       [--benchmark_format=console|json] [--benchmark_out=<file>]\n", argv[0]);
+                return 1;
+            }
+        }
+
+        std::regex pattern(filter);
+        std::vector<BenchResult> results;
+        bool console = format != "json";
+
+        if (console)
+            printf("%-44s %14s %14s %12s %14s\n", "Benchmark", "Time", "CPU", "Iterations", "Rate");
+
+        for (const Entry& entry : benchmarks())
+        {
+            if (!std::regex_search(entry.name, pattern))
+                continue;
+
+            BenchResult result = measure(entry, minTime);
+            results.push_back(result);
+
+            if (console)
+                printConsole(result);
+        }
+
+        if (!console)
+            writeJson(stdout, argv[0], results);
+
+        if (!outPath.empty())
+        {
+            FILE* out = fopen(outPath.c_str(), "w");
+            if (!out)
+            {
+                fprintf(stderr, "cannot write %s\n", outPath.c_str());
+                return 1;
+            }
+            writeJson(out, argv[0], results);
+            fclose(out);
+        }
+
+        return 0;
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        Body body;
+    };
+
+    static std::vector<Entry>& benchmarks()
+    {
+        static std::vector<Entry> entries;
+        return entries;
+    }
+
+    static const char* flag(const char* arg, const char* name)
+    {
+        size_t length = strlen(name);
+        return strncmp(arg, name, length) == 0 ? arg + length : nullptr;
+    }
+
+    // Grows the iteration count until one run lasts minTime, the last run is reported
+    static BenchResult measure(const Entry& entry, double minTime)
+    {
+        uint64_t iterations = 1;
+
+        while (true)
+        {
+            BenchState state(iterations);
+
+            clock_t cpuStart = clock();
+            auto start = std::chrono::steady_clock::now();
+            entry.body(state);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double cpuSeconds = (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+
+            if (seconds >= minTime || iterations >= 1000000000ULL)
+            {
+                return {
+                    entry.name,
+                    iterations,
+                    seconds * 1e9 / iterations,
+                    cpuSeconds * 1e9 / iterations,
+                    state.itemsProcessed() / seconds,
+                    state.bytesProcessed() / seconds
+                };
+            }
+
+            // Aim 40% past the target so the next run is normally the last
+            double scale = seconds > 0 ? minTime * 1.4 / seconds : 10;
+            if (scale > 10)
+                scale = 10;
+            if (scale < 2)
+                scale = 2;
+            iterations = (uint64_t)(iterations * scale);
+        }
+    }
+
+    static void printConsole(const BenchResult& result)
+    {
+        char rate[32] = "";
+        if (result.bytesPerSecond > 0)
+            snprintf(rate, sizeof(rate), "%.1fMiB/s", result.bytesPerSecond / (1024.0 * 1024.0));
+        else if (result.itemsPerSecond > 0)
+            snprintf(rate, sizeof(rate), "%.2fM/s", result.itemsPerSecond / 1e6);
+
+        printf("%-44s %11.1f ns %11.1f ns %12llu %14s\n", result.name.c_str(), result.realNanos,
+               result.cpuNanos, (unsigned long long)result.iterations, rate);
+    }
+
+    static void writeJson(FILE* out, const char* executable, const std::vector<BenchResult>& results)
+    {
+        char date[32];
+        time_t now = time(nullptr);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+        fprintf(out, "{\n  \"context\": {\n");
+        fprintf(out, "    \"date\": \"%s\",\n", date);
+        fprintf(out, "    \"executable\": \"%s\",\n", executable);
+#ifdef NDEBUG
+        fprintf(out, "    \"library_build_type\": \"release\"\n");
+#else
+        fprintf(out, "    \"library_build_type\": \"debug\"\n");
+#endif
+        fprintf(out, "  },\n  \"benchmarks\": [\n");
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const BenchResult& result = results[i];
+
+            fprintf(out, "    {\n");
+            fprintf(out, "      \"name\": \"%s\",\n", result.name.c_str());
+            fprintf(out, "      \"run_name\": \"%s\",\n", result.name.c_str());
+            fprintf(out, "      \"run_type\": \"iteration\",\n");
+            fprintf(out, "      \"iterations\": %llu,\n", (unsigned long long)result.iterations);
+            fprintf(out, "      \"real_time\": %.3f,\n", result.realNanos);
+            fprintf(out, "      \"cpu_time\": %.3f,\n", result.cpuNanos);
+            fprintf(out, "      \"time_unit\": \"ns\"");
+            if (result.bytesPerSecond > 0)
+                fprintf(out, ",\n      \"bytes_per_second\": %.1f", result.bytesPerSecond);
+            if (result.itemsPerSecond > 0)
+                fprintf(out, ",\n      \"items_per_second\": %.1f", result.itemsPerSecond);
+            fprintf(out, "\n    }%s\n", i + 1 < results.size() ? "," : "");
+        }
+
+        fprintf(out, "  ]\n}\n");
+    }
+};
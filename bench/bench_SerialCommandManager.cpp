@@ -0,0 +1,307 @@
+#include <ArduinoFake.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SerialCommandManager.h"
+#include "BaseCommandHandler.h"
+#include "MemoryStream.h"
+#include "Bench.h"
+
+// Native benchmarks for the receive parser, handler dispatch and the message writers,
+// see [env:bench] in platformio.ini
+
+// ============================================================================
+// Benchmark Helpers
+// ============================================================================
+
+// Keeps the receive ring full of back to back copies of one message
+class MessageFeed {
+public:
+    MessageFeed(MemoryStream& stream, const std::string& message) : stream(stream), message(message) {}
+
+    // Called before each readCommands(), tops the ring up once less than a message is left
+    void fill() {
+        if (stream.available() >= (int)message.size())
+            return;
+
+        size_t count;
+        while ((count = stream.inject(reinterpret_cast<const uint8_t*>(message.data()) + offset,
+                                      message.size() - offset)) > 0)
+            offset = (offset + count) % message.size();
+    }
+
+private:
+    MemoryStream& stream;
+    std::string message;
+    size_t offset = 0;
+};
+
+// Empties the transmit ring, returns the bytes written since the last call
+static uint64_t drain(MemoryStream& stream) {
+    uint64_t written = stream.pendingOutput();
+    stream.clear();
+    return written;
+}
+
+// Handles every command it lists, without replying
+class ListedHandler : public ISerialCommandHandler {
+public:
+    std::vector<std::string> names;
+    std::vector<const char*> commands;
+
+    ListedHandler(int handlerIndex, int commandCount) {
+        for (int i = 0; i < commandCount; i++)
+            names.push_back("H" + std::to_string(handlerIndex) + "C" + std::to_string(i));
+        for (const std::string& name : names)
+            commands.push_back(name.c_str());
+    }
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        count = commands.size();
+        return commands.data();
+    }
+};
+
+// Exposes the protected acknowledgement helpers
+class AckHandler : public BaseCommandHandler {
+public:
+    using BaseCommandHandler::sendAckOk;
+    using BaseCommandHandler::sendAckErr;
+    using BaseCommandHandler::ackOk;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        count = 0;
+        return nullptr;
+    }
+};
+
+static void makeParams(StringKeyValue* params, int count) {
+    for (int i = 0; i < count; i++) {
+        snprintf(params[i].key, sizeof(params[i].key), "k%d", i);
+        snprintf(params[i].value, sizeof(params[i].value), "%d", i * 1000 + 13);
+    }
+}
+
+// ============================================================================
+// Parse Benchmarks
+// ============================================================================
+
+// "CMD:k0=xxx;k1=xxx\n" with values padded so the message is length bytes, terminator included
+static std::string makeMessage(int paramCount, int length) {
+    if (paramCount == 0)
+        return std::string(length - 1, 'C') + "\n";
+
+    int overhead = 4 + 1 + paramCount * 3 + (paramCount - 1);     // "CMD:", '\n', "kN=", ';'
+    int valueLength = (length - overhead) / paramCount;
+    if (valueLength < 1 || valueLength > DefaultMaxParamValueLength)
+        return "";
+
+    std::string message = "CMD:";
+    for (int i = 0; i < paramCount; i++) {
+        if (i > 0)
+            message += ';';
+        message += "k" + std::to_string(i) + "=" + std::string(valueLength, 'v');
+    }
+
+    // Rounding leftovers go on the last value
+    message += std::string(length - 1 - message.size(), 'v');
+    return message + "\n";
+}
+
+static void registerParse() {
+    const int paramCounts[] = { 0, 1, 3, 5 };
+    const int lengths[] = { 16, 32, 64, 120 };
+
+    for (int paramCount : paramCounts) {
+        for (int length : lengths) {
+            std::string message = makeMessage(paramCount, length);
+            if (message.empty() || (paramCount == 0 && length > DefaultMaxCommandLength))
+                continue;
+
+            Bench::add("Parse/params:" + std::to_string(paramCount) + "/length:" + std::to_string(length),
+                [message](BenchState& state) {
+                    MemoryStream stream;
+                    MessageFeed feed(stream, message);
+                    SerialCommandManager manager(&stream, nullptr);
+
+                    for (uint64_t i = 0; i < state.iterations(); i++) {
+                        feed.fill();
+                        manager.readCommands();
+                    }
+
+                    state.setItemsProcessed(state.iterations());
+                    state.setBytesProcessed(state.iterations() * message.size());
+                });
+        }
+    }
+}
+
+// ============================================================================
+// Dispatch Benchmarks
+// ============================================================================
+
+// The command sent is the last one of the last handler, the longest lookup
+static void registerDispatch() {
+    const int handlerCounts[] = { 1, 4, 16 };
+    const int commandCounts[] = { 1, 4, 8 };
+
+    for (int handlerCount : handlerCounts) {
+        for (int commandCount : commandCounts) {
+            Bench::add("Dispatch/handlers:" + std::to_string(handlerCount) + "/commands:" + std::to_string(commandCount),
+                [handlerCount, commandCount](BenchState& state) {
+                    std::vector<std::unique_ptr<ListedHandler>> listed;
+                    std::vector<ISerialCommandHandler*> handlers;
+                    for (int i = 0; i < handlerCount; i++) {
+                        listed.emplace_back(new ListedHandler(i, commandCount));
+                        handlers.push_back(listed.back().get());
+                    }
+
+                    MemoryStream stream;
+                    MessageFeed feed(stream, listed.back()->names.back() + "\n");
+                    SerialCommandManager manager(&stream, nullptr);
+                    manager.registerHandlers(handlers.data(), handlers.size());
+
+                    for (uint64_t i = 0; i < state.iterations(); i++) {
+                        feed.fill();
+                        manager.readCommands();
+                    }
+
+                    state.setItemsProcessed(state.iterations());
+                });
+        }
+    }
+}
+
+// ============================================================================
+// Send Benchmarks
+// ============================================================================
+
+static void registerSend() {
+    const int paramCounts[] = { 0, 1, 3, 5 };
+
+    for (int paramCount : paramCounts) {
+        Bench::add("SendCommand/params:" + std::to_string(paramCount),
+            [paramCount](BenchState& state) {
+                MemoryStream stream;
+                SerialCommandManager manager(&stream, nullptr);
+                StringKeyValue params[MaximumParameterCount];
+                makeParams(params, paramCount);
+
+                uint64_t written = 0;
+
+                for (uint64_t i = 0; i < state.iterations(); i++) {
+                    manager.sendCommand("LED", "on", "", params, paramCount);
+                    written += drain(stream);
+                }
+
+                state.setItemsProcessed(state.iterations());
+                state.setBytesProcessed(written);
+            });
+    }
+
+    Bench::add("SendCommand/buffered/params:3", [](BenchState& state) {
+        MemoryStream stream;
+        SerialCommandManager manager(&stream, nullptr);
+        manager.setTxBuffer(256);
+        StringKeyValue params[MaximumParameterCount];
+        makeParams(params, 3);
+
+        uint64_t written = 0;
+
+        for (uint64_t i = 0; i < state.iterations(); i++) {
+            manager.sendCommand("LED", "on", "", params, 3);
+            manager.poll();
+            written += drain(stream);
+        }
+
+        state.setItemsProcessed(state.iterations());
+        state.setBytesProcessed(written);
+    });
+}
+
+// ============================================================================
+// Acknowledgement Benchmarks
+// ============================================================================
+
+static void registerAck() {
+    Bench::add("AckOk/params:0", [](BenchState& state) {
+        MemoryStream stream;
+        SerialCommandManager manager(&stream, nullptr);
+        AckHandler handler;
+
+        for (uint64_t i = 0; i < state.iterations(); i++) {
+            handler.sendAckOk(&manager, "LED", nullptr, 0);
+            drain(stream);
+        }
+
+        state.setItemsProcessed(state.iterations());
+    });
+
+    Bench::add("AckOk/params:1", [](BenchState& state) {
+        MemoryStream stream;
+        SerialCommandManager manager(&stream, nullptr);
+        AckHandler handler;
+        StringKeyValue param;
+        makeParams(&param, 1);
+
+        for (uint64_t i = 0; i < state.iterations(); i++) {
+            handler.sendAckOk(&manager, "LED", &param);
+            drain(stream);
+        }
+
+        state.setItemsProcessed(state.iterations());
+    });
+
+    Bench::add("AckOk/builder/params:2", [](BenchState& state) {
+        MemoryStream stream;
+        SerialCommandManager manager(&stream, nullptr);
+        AckHandler handler;
+
+        for (uint64_t i = 0; i < state.iterations(); i++) {
+            handler.ackOk(&manager, "LED").kv("pin", 13).kv("state", "ON").send();
+            drain(stream);
+        }
+
+        state.setItemsProcessed(state.iterations());
+    });
+
+    Bench::add("AckErr/params:0", [](BenchState& state) {
+        MemoryStream stream;
+        SerialCommandManager manager(&stream, nullptr);
+        AckHandler handler;
+
+        for (uint64_t i = 0; i < state.iterations(); i++) {
+            handler.sendAckErr(&manager, "LED", "Invalid pin", nullptr, 0);
+            drain(stream);
+        }
+
+        state.setItemsProcessed(state.iterations());
+    });
+}
+
+// ============================================================================
+// Run all benchmarks
+// ============================================================================
+
+int main(int argc, char** argv) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    When(Method(ArduinoFake(), micros)).AlwaysReturn(0);
+
+    registerParse();
+    registerDispatch();
+    registerSend();
+    registerAck();
+
+    return Bench::run(argc, argv);
+}
@@ -39,9 +39,12 @@ public:
         digitalWrite(_pinDirection, pinStatus);
         analogWrite(_pinSpeed, constrain(speed, 0, 255));
 
-        char debugMsg[DefaultMaxMessageLength];
-        snprintf_P(debugMsg, sizeof(debugMsg), "Motor moved %s at speed %d", direction, speed);
-        sender->sendDebug(debugMsg, "MotorHandler");
+        // Format only when debug output is on, then pass the identifier separately
+        if (sender->isLogEnabled(LogLevel::Debug)) {
+            char message[40];
+            snprintf(message, sizeof(message), "Motor moved %s at speed %d", direction, speed);
+            sender->sendDebug(message, F("MotorHandler"));
+        }
         return true;
     }
 
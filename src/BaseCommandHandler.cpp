@@ -9,14 +9,11 @@ void BaseCommandHandler::sendAckOk(SerialCommandManager* sender, const char* cmd
     // ACK:<command>=<result>
     // If no explicit msg provided, use "ok" (lowercase per examples)
 
-    // Build payload: cmd + "=ok"
-    char payload[64]; // ACK payload buffer
-    snprintf(payload, sizeof(payload), "%s=ok", cmd);
-
+    // Written in a single pass, the command is never truncated
     if (param == nullptr)
-        sender->sendCommand("ACK", payload);
-    else
-        sender->sendCommand("ACK", payload, "", const_cast<StringKeyValue*>(param), paramCount);
+        paramCount = 0;
+
+    sender->sendAck(cmd, F("ok"), param, paramCount);
 }
 
 void BaseCommandHandler::sendAckErr(SerialCommandManager* sender, const char* cmd, const char* err, const StringKeyValue* param, uint8_t paramCount)
@@ -27,16 +24,13 @@ void BaseCommandHandler::sendAckErr(SerialCommandManager* sender, const char* cm
     // Errors are also reported via ACK with the error text after '=' per Commands.md examples:
     // ACK:<command>=<error message>
 
-    char payload[64]; // ACK payload buffer
-    if (err && err[0] != '\0')
-        snprintf(payload, sizeof(payload), "%s=%s", cmd, err);
-    else
-        snprintf(payload, sizeof(payload), "%s=error", cmd);
-
     if (param == nullptr)
-        sender->sendCommand("ACK", payload);
+        paramCount = 0;
+
+    if (err && err[0] != '\0')
+        sender->sendAck(cmd, err, param, paramCount);
     else
-        sender->sendCommand("ACK", payload, "", param, paramCount);
+        sender->sendAck(cmd, F("error"), param, paramCount);
 }
 
 void BaseCommandHandler::sendAckErr(SerialCommandManager* sender, const char* cmd, const __FlashStringHelper* err, const StringKeyValue* param, uint8_t paramCount)
@@ -47,27 +41,19 @@ void BaseCommandHandler::sendAckErr(SerialCommandManager* sender, const char* cm
     // Errors are also reported via ACK with the error text after '=' per Commands.md examples:
     // ACK:<command>=<error message>
 
-    // For FlashStringHelper, we need to read from program memory
-    // Create a buffer to hold the error message from flash
-    char errorBuf[64];
+    // The error text is streamed from program memory, no RAM copy is made
+    if (param == nullptr)
+        paramCount = 0;
+
     if (err)
-    {
-        // Copy from program memory to RAM
-        strncpy_P(errorBuf, (const char*)err, sizeof(errorBuf) - 1);
-        errorBuf[sizeof(errorBuf) - 1] = '\0';
-    }
+        sender->sendAck(cmd, err, param, paramCount);
     else
-    {
-        strcpy(errorBuf, "error");
-    }
-
-    char payload[64]; // ACK payload buffer
-    snprintf(payload, sizeof(payload), "%s=%s", cmd, errorBuf);
+        sender->sendAck(cmd, F("error"), param, paramCount);
+}
 
-    if (param == nullptr)
-        sender->sendCommand("ACK", payload);
-    else
-        sender->sendCommand("ACK", payload, "", param, paramCount);
+ParamBuilder BaseCommandHandler::ackOk(SerialCommandManager* sender, const char* cmd)
+{
+    return sender->replyAck(cmd, F("ok"));
 }
 
 StringKeyValue BaseCommandHandler::makeParam(uint8_t key, uint8_t value)
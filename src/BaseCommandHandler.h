@@ -6,8 +6,9 @@
  * @brief Small helper base class that centralizes ACK formatting used by command handlers.
  *
  * Handlers can inherit from `BaseCommandHandler` to get protected `sendAckOk` / `sendAckErr`
- * helpers that delegate to `SerialCommandManager::sendCommand(...)` while keeping the
- * communications layer abstract.
+ * helpers that delegate to `SerialCommandManager::sendAck(...)` while keeping the
+ * communications layer abstract. ACKs are written to the port in a single pass, with no
+ * intermediate formatting buffer.
  *
  * This follows the typical Arduino library comment style (Doxygen-compatible) so the
  * documentation can be generated or read inline in sketches.
@@ -47,6 +48,18 @@ protected:
      */
     void sendAckErr(SerialCommandManager* sender, const char* cmd, const __FlashStringHelper* err, const StringKeyValue* param = nullptr, uint8_t paramCount = 1);
 
+    /**
+     * @brief Start a successful acknowledgement whose parameters are written directly to the port.
+     *
+     * Use instead of makeParam() when a response carries several values, e.g.
+     * `ackOk(sender, command).kv("pin", 13).kv("state", "ON").send();`
+     *
+     * @param sender Pointer to the `SerialCommandManager` that will perform the send.
+     * @param cmd The command header/string to include in the ACK.
+     * @return Builder for adding parameters, completed by `send()`.
+     */
+    ParamBuilder ackOk(SerialCommandManager* sender, const char* cmd);
+
     /**
      * @brief Create a StringKeyValue from two uint8_t values.
      *
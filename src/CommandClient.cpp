@@ -0,0 +1,270 @@
+#include "CommandClient.h"
+
+#if SCM_CONCURRENT
+
+#include <chrono>
+
+static uint32_t steadyMilliseconds()
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CommandClient::CommandClient(SerialCommandManager* manager, uint8_t window, uint32_t timeoutMilliseconds)
+    : _manager(manager), _registry(_self, 1), _window(window > 0 ? window : 1),
+      _timeout(timeoutMilliseconds), _clock(steadyMilliseconds), _wheel(ClientTimerSlots)
+{
+    _self[0] = this;
+    _wheelTick = _clock() / ClientTimerTick;
+    _manager->setRegistry(&_registry);
+}
+
+CommandClient::~CommandClient()
+{
+    if (_manager->getRegistry() == &_registry)
+        _manager->setRegistry(nullptr);
+
+    while (!_requests.empty())
+    {
+        CommandResult result;
+        result.timedOut = true;
+        complete(_requests.begin()->first, result);
+    }
+}
+
+void CommandClient::setClock(std::function<uint32_t()> clock)
+{
+    _clock = clock;
+    _wheelTick = _clock() / ClientTimerTick;
+}
+
+std::future<CommandResult> CommandClient::send(const char* command, const char* message, const StringKeyValue* params, uint8_t paramCount)
+{
+    Request request;
+    request.command = command ? command : "";
+    request.message = message ? message : "";
+
+    if (params)
+        request.params.assign(params, params + paramCount);
+
+    std::future<CommandResult> future = request.promise.get_future();
+    enqueue(std::move(request));
+    return future;
+}
+
+void CommandClient::send(CommandCallback callback, const char* command, const char* message, const StringKeyValue* params, uint8_t paramCount)
+{
+    Request request;
+    request.command = command ? command : "";
+    request.message = message ? message : "";
+    request.callback = callback;
+
+    if (params)
+        request.params.assign(params, params + paramCount);
+
+    enqueue(std::move(request));
+}
+
+uint32_t CommandClient::enqueue(Request&& request)
+{
+    uint32_t id = _nextId++;
+    bool tooLong = request.command.size() > DefaultMaxParamKeyLength;
+    _requests.emplace(id, std::move(request));
+
+    // ACK:<command>=<result> would not parse, so the request could only time out
+    if (tooLong)
+    {
+        CommandResult result;
+        result.rejected = true;
+        complete(id, result);
+        return id;
+    }
+
+    _waiting.push_back(id);
+    transmit();
+    return id;
+}
+
+void CommandClient::transmit()
+{
+    // Flow control on the manager (credits, XOFF) holds commands back until the device has room
+    while (!_waiting.empty() && _inFlight.size() < _window && _manager->canSend())
+    {
+        uint32_t id = _waiting.front();
+        _waiting.pop_front();
+
+        Request& request = _requests[id];
+        request.deadline = _clock() + _timeout;
+        _wheel[(request.deadline / ClientTimerTick) % ClientTimerSlots].push_back(id);
+        _inFlight.push_back(id);
+
+        if (_correlationIds && request.params.size() < MaximumParameterCount)
+        {
+            std::vector<StringKeyValue> params(1);
+            strcpy(params[0].key, SCM_CORRELATION_KEY);
+            snprintf(params[0].value, sizeof(params[0].value), "%lu", (unsigned long)id);
+            params.insert(params.end(), request.params.begin(), request.params.end());
+
+            _manager->sendCommand(request.command.c_str(), request.message.c_str(), "", params.data(), (uint8_t)params.size());
+        }
+        else
+        {
+            _manager->sendCommand(request.command.c_str(), request.message.c_str(), "",
+                request.params.empty() ? nullptr : request.params.data(), (uint8_t)request.params.size());
+        }
+    }
+}
+
+void CommandClient::setCorrelationIds(bool enabled)
+{
+    _correlationIds = enabled;
+}
+
+void CommandClient::poll()
+{
+    // A reply may be followed by more, keep reading while messages are being handled
+    for (uint16_t i = 0; i <= _window; i++)
+    {
+        _replied = false;
+        _manager->readCommands();
+
+        if (!_replied)
+            break;
+    }
+
+    expire(_clock());
+    transmit();
+}
+
+void CommandClient::expire(uint32_t now)
+{
+    uint32_t target = now / ClientTimerTick;
+    uint32_t ticks = target - _wheelTick;
+
+    if (ticks > ClientTimerSlots)
+        ticks = ClientTimerSlots;
+
+    // Visit each slot whose tick has fully elapsed, requests due in a later round stay put
+    for (uint32_t i = 0; i < ticks; i++)
+    {
+        // A timeout callback may send, adding to this slot, so walk a copy taken out of the wheel
+        std::vector<uint32_t> due;
+        due.swap(_wheel[(_wheelTick + i) % ClientTimerSlots]);
+
+        for (uint32_t id : due)
+        {
+            std::map<uint32_t, Request>::iterator request = _requests.find(id);
+
+            if (request == _requests.end())
+                continue;
+
+            if (request->second.deadline / ClientTimerTick < target)
+            {
+                CommandResult result;
+                result.timedOut = true;
+                complete(id, result);
+            }
+            else
+            {
+                _wheel[(_wheelTick + i) % ClientTimerSlots].push_back(id);
+            }
+        }
+    }
+
+    _wheelTick = target;
+}
+
+void CommandClient::complete(uint32_t id, CommandResult& result)
+{
+    std::map<uint32_t, Request>::iterator request = _requests.find(id);
+
+    if (request == _requests.end())
+        return;
+
+    for (std::deque<uint32_t>::iterator it = _inFlight.begin(); it != _inFlight.end(); ++it)
+    {
+        if (*it == id)
+        {
+            _inFlight.erase(it);
+            break;
+        }
+    }
+
+    for (std::deque<uint32_t>::iterator it = _waiting.begin(); it != _waiting.end(); ++it)
+    {
+        if (*it == id)
+        {
+            _waiting.erase(it);
+            break;
+        }
+    }
+
+    result.command = request->second.command;
+
+    if (request->second.callback)
+        request->second.callback(result);
+    else
+        request->second.promise.set_value(result);
+
+    _requests.erase(request);
+}
+
+bool CommandClient::handleCommand(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount)
+{
+    // Only ACK is registered, ACK:<command>=<result>[:<params>] parses as a first parameter <command>=<result>
+    (void)command;
+
+    if (paramCount == 0)
+        return false;
+
+    _replied = true;
+
+    CommandResult result;
+    result.result = params[0].value;
+    result.params.assign(params + 1, params + paramCount);
+
+    // Prefer the correlation id, replies to identical commands may arrive in any order
+    const char* correlationId = sender->getCorrelationId();
+
+    if (correlationId[0] != '\0')
+    {
+        uint32_t id = (uint32_t)strtoul(correlationId, nullptr, 10);
+        std::map<uint32_t, Request>::iterator request = _requests.find(id);
+
+        if (request == _requests.end() || request->second.command != params[0].key)
+            return false;
+
+        complete(id, result);
+        return true;
+    }
+
+    for (uint32_t id : _inFlight)
+    {
+        if (_requests[id].command == params[0].key)
+        {
+            complete(id, result);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* const* CommandClient::supportedCommands(size_t& count) const
+{
+    static const char* cmds[] = { "ACK" };
+    count = 1;
+    return cmds;
+}
+
+size_t CommandClient::getInFlight() const
+{
+    return _inFlight.size();
+}
+
+size_t CommandClient::getWaiting() const
+{
+    return _waiting.size();
+}
+
+#endif
@@ -0,0 +1,171 @@
+#pragma once
+#include <Arduino.h>
+#include <SerialCommandManager.h>
+
+#if SCM_CONCURRENT
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <string>
+#include <vector>
+
+const uint8_t DefaultClientWindow = 8;
+const uint32_t DefaultClientTimeout = 1000;
+const uint16_t ClientTimerTick = 10;        // timer wheel resolution in milliseconds
+const uint16_t ClientTimerSlots = 64;
+
+/**
+ * @brief Outcome of a command sent by CommandClient.
+ */
+struct CommandResult
+{
+    bool timedOut = false;                  // no ACK arrived before the timeout
+    bool rejected = false;                  // not sent, the command name is too long to come back in an ACK
+    std::string command;                    // the command that was sent
+    std::string result;                     // text after '=' in ACK:<command>=<result>
+    std::vector<StringKeyValue> params;     // parameters following the result
+
+    /**
+     * @brief Gets whether the device acknowledged the command with "ok".
+     */
+    bool isOk() const { return !timedOut && !rejected && result == "ok"; }
+};
+
+typedef std::function<void(const CommandResult&)> CommandCallback;
+
+/**
+ * @brief Host side client that pipelines commands to a device and matches the ACK replies.
+ *
+ * Built on a SerialCommandManager, which frames, parses and serializes messages. Up to a window
+ * of commands are in flight at once, further commands wait in a queue. Each ACK:<command>=<result>
+ * completes the request with the same correlation id (see setCorrelationIds()), or otherwise the
+ * oldest in-flight request for that command, fulfilling its std::future or calling its callback.
+ * Requests without a reply before the timeout complete with timedOut set, timeouts are tracked
+ * with a timer wheel so checking them costs the same however many are in flight.
+ *
+ * The reply carries the command name as a parameter key, so commands longer than
+ * DefaultMaxParamKeyLength are never sent and complete at once with rejected set.
+ *
+ * The client registers itself as the manager's handler registry. Call poll() regularly, from the
+ * thread that sends, to read replies and expire timeouts.
+ *
+ * Commands are only sent while the manager's flow control allows, so with
+ * setFlowControl(FlowControl::Credit) on both sides the device's receive buffer never overflows.
+ *
+ * Example:
+ * `
+ * FdStream port;
+ * port.openTty("/dev/ttyUSB0", 115200);
+ * SerialCommandManager manager(&port, nullptr);
+ * CommandClient client(&manager);
+ *
+ * std::future<CommandResult> reply = client.send("LED", nullptr, params, 2);
+ * while (reply.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready)
+ *     client.poll();
+ * `
+ */
+class CommandClient : public ISerialCommandHandler
+{
+private:
+    struct Request
+    {
+        std::string command;
+        std::string message;
+        std::vector<StringKeyValue> params;
+        uint32_t deadline;
+        std::promise<CommandResult> promise;
+        CommandCallback callback;
+    };
+
+    SerialCommandManager* _manager;
+    SerialCommandRegistry _registry;
+    ISerialCommandHandler* _self[1];
+    uint8_t _window;
+    uint32_t _timeout;
+    std::function<uint32_t()> _clock;
+
+    uint32_t _nextId = 1;
+    std::map<uint32_t, Request> _requests;
+    std::deque<uint32_t> _inFlight;         // sent, oldest first
+    std::deque<uint32_t> _waiting;          // queued until the window has room
+    std::vector<std::vector<uint32_t>> _wheel;
+    uint32_t _wheelTick;
+    bool _replied = false;
+    bool _correlationIds = false;
+
+    uint32_t enqueue(Request&& request);
+    void transmit();
+    void complete(uint32_t id, CommandResult& result);
+    void expire(uint32_t now);
+
+public:
+    /**
+     * @brief Constructs a client sending through manager.
+     *
+     * @param manager The manager connected to the device.
+     * @param window Maximum number of commands awaiting an ACK at once.
+     * @param timeoutMilliseconds Time allowed for each ACK.
+     */
+    CommandClient(SerialCommandManager* manager, uint8_t window = DefaultClientWindow, uint32_t timeoutMilliseconds = DefaultClientTimeout);
+
+    /**
+     * @brief Destructor, outstanding requests complete as timed out.
+     */
+    ~CommandClient();
+
+    /**
+     * @brief Sends a command, or queues it if the window is full.
+     *
+     * @return Future completed by the ACK or the timeout, or already completed as rejected when the
+     * command name is longer than DefaultMaxParamKeyLength.
+     */
+    std::future<CommandResult> send(const char* command, const char* message = nullptr, const StringKeyValue* params = nullptr, uint8_t paramCount = 0);
+
+    /**
+     * @brief Sends a command, or queues it if the window is full, calling callback on completion.
+     *
+     * callback is called before returning, with rejected set, when the command name is longer than
+     * DefaultMaxParamKeyLength.
+     */
+    void send(CommandCallback callback, const char* command, const char* message = nullptr, const StringKeyValue* params = nullptr, uint8_t paramCount = 0);
+
+    /**
+     * @brief Reads replies and expires timed out requests.
+     */
+    void poll();
+
+    /**
+     * @brief Adds a correlation id (#=<n>) to every command so replies are matched by id.
+     *
+     * Lets identical commands be pipelined and replies arrive in any order. The device must echo
+     * ids, which SerialCommandManager does for ACKs sent while handling a command. The id uses
+     * one of the MaximumParameterCount parameters, it is omitted if a command uses them all.
+     *
+     * @param enabled true to send correlation ids.
+     */
+    void setCorrelationIds(bool enabled);
+
+    /**
+     * @brief Replaces the millisecond clock, e.g. for tests. Defaults to std::chrono::steady_clock.
+     *
+     * @param clock Function returning the current time in milliseconds.
+     */
+    void setClock(std::function<uint32_t()> clock);
+
+    /**
+     * @brief Gets the number of commands sent and awaiting an ACK.
+     */
+    size_t getInFlight() const;
+
+    /**
+     * @brief Gets the number of commands waiting for room in the window.
+     */
+    size_t getWaiting() const;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount) override;
+    const char* const* supportedCommands(size_t& count) const override;
+};
+
+#endif
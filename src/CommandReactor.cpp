@@ -0,0 +1,176 @@
+#include "CommandReactor.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+CommandReactor::CommandReactor(uint16_t maxEvents)
+{
+    _maxEvents = maxEvents > 0 ? maxEvents : 1;
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    _events = new epoll_event[_maxEvents];
+}
+
+CommandReactor::~CommandReactor()
+{
+    while (_streams)
+        remove(_streams);
+
+    if (_epollFd >= 0)
+        ::close(_epollFd);
+
+    delete[] static_cast<epoll_event*>(_events);
+}
+
+bool CommandReactor::isValid() const
+{
+    return _epollFd >= 0;
+}
+
+bool CommandReactor::add(SerialCommandManager* manager, FdStream* stream)
+{
+    if (!isValid() || !manager || !stream || !stream->isOpen() || stream->_manager)
+        return false;
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = stream;
+
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, stream->getFd(), &event) != 0)
+        return false;
+
+    stream->_manager = manager;
+    stream->_watchingOutput = false;
+    stream->_nextRegistered = _streams;
+    _streams = stream;
+    return true;
+}
+
+bool CommandReactor::remove(FdStream* stream)
+{
+    if (!stream || !stream->_manager)
+        return false;
+
+    if (stream->getFd() >= 0)
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, stream->getFd(), nullptr);
+
+    for (FdStream** link = &_streams; *link; link = &(*link)->_nextRegistered)
+    {
+        if (*link == stream)
+        {
+            *link = stream->_nextRegistered;
+            break;
+        }
+    }
+
+    stream->_nextRegistered = nullptr;
+    stream->_manager = nullptr;
+    stream->_watchingOutput = false;
+    return true;
+}
+
+int CommandReactor::poll(int timeoutMilliseconds)
+{
+    if (!isValid())
+        return -1;
+
+    bool receiving = false;
+
+    for (FdStream* stream = _streams; stream && !receiving; stream = stream->_nextRegistered)
+        receiving = stream->_manager->isReceiving();
+
+    if (receiving && (timeoutMilliseconds < 0 || timeoutMilliseconds > ReactorTimeoutCheckInterval))
+        timeoutMilliseconds = ReactorTimeoutCheckInterval;
+
+    epoll_event* events = static_cast<epoll_event*>(_events);
+    int ready = epoll_wait(_epollFd, events, _maxEvents, timeoutMilliseconds);
+
+    if (ready < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < ready; i++)
+    {
+        FdStream* stream = static_cast<FdStream*>(events[i].data.ptr);
+
+        if (!stream->_manager)
+            continue;
+
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            service(stream);
+        else
+            stream->_manager->poll();
+
+        if (!stream->isOpen())
+        {
+            remove(stream);
+            continue;
+        }
+
+        updateOutputWatch(stream);
+    }
+
+    if (receiving)
+        checkTimeouts();
+
+    return ready;
+}
+
+void CommandReactor::service(FdStream* stream)
+{
+    // Stops once a message ends with nothing left buffered. A message split across reads refills the
+    // buffer from the descriptor part way through, so one call can read it more than once, but a
+    // descriptor that still has data after that is reported ready again rather than drained here,
+    // so one busy device cannot starve the others
+    do
+    {
+        stream->_manager->readCommands();
+    }
+    while (stream->isOpen() && stream->_readPos < stream->_readLength);
+}
+
+void CommandReactor::checkTimeouts()
+{
+    FdStream* stream = _streams;
+
+    while (stream)
+    {
+        FdStream* next = stream->_nextRegistered;
+
+        if (stream->_manager->isReceiving())
+        {
+            stream->_manager->readCommands();
+
+            if (!stream->isOpen())
+                remove(stream);
+            else
+                updateOutputWatch(stream);
+        }
+
+        stream = next;
+    }
+}
+
+void CommandReactor::watchOutput(FdStream* stream)
+{
+    if (stream && stream->_manager)
+        updateOutputWatch(stream);
+}
+
+void CommandReactor::updateOutputWatch(FdStream* stream)
+{
+    bool pending = stream->_manager->getTxPending() > 0;
+
+    if (pending == stream->_watchingOutput)
+        return;
+
+    epoll_event event = {};
+    event.events = pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.ptr = stream;
+
+    if (epoll_ctl(_epollFd, EPOLL_CTL_MOD, stream->getFd(), &event) == 0)
+        stream->_watchingOutput = pending;
+}
+
+#endif
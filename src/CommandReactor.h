@@ -0,0 +1,117 @@
+#pragma once
+
+// Linux only, uses epoll
+#if defined(__linux__)
+
+#include <Arduino.h>
+#include <SerialCommandManager.h>
+#include <FdStream.h>
+
+const uint16_t DefaultReactorEvents = 64;
+
+// Longest poll() wait while a registered manager has a partial message, so its timeout is reported
+const int ReactorTimeoutCheckInterval = 50;
+
+/**
+ * @brief Drives many SerialCommandManager instances over FdStreams from a single thread.
+ *
+ * Streams are registered with epoll and poll() waits until one or more have data, then calls
+ * readCommands() only on those managers, once for each message received. While a manager has a
+ * partial message poll() waits at most ReactorTimeoutCheckInterval, so the message timeout is still
+ * reported on an idle descriptor. Managers with a transmit buffer that still holds output
+ * are woken again when their descriptor can accept more. Use a transmit buffer with a write timeout
+ * of 0 on the FdStream so a slow device never blocks the other managers.
+ *
+ * Example:
+ * `
+ * CommandReactor reactor;
+ * reactor.add(&deviceMgr, &devicePort);
+ *
+ * while (running)
+ *     reactor.poll(100);
+ * `
+ */
+class CommandReactor
+{
+private:
+    int _epollFd;
+    uint16_t _maxEvents;
+    void* _events;      // struct epoll_event[_maxEvents], kept out of the header
+    FdStream* _streams = nullptr;   // Registered streams, linked through FdStream::_nextRegistered
+
+    /**
+     * @brief Adds or removes interest in output for a stream depending on its queued output.
+     */
+    void updateOutputWatch(FdStream* stream);
+
+    /**
+     * @brief Reads every message already buffered by the stream, finishing one cut off by the buffer end, then sends any queued output.
+     *
+     * readCommands() handles one message per call, and FdStream buffers several, so reading once per
+     * epoll event would strand pipelined messages in the buffer with the descriptor no longer ready.
+     */
+    void service(FdStream* stream);
+
+    /**
+     * @brief Calls readCommands() for managers with a partial message so their timeout is reported.
+     */
+    void checkTimeouts();
+
+public:
+    /**
+     * @brief Constructs a reactor.
+     *
+     * @param maxEvents Maximum number of ready streams handled per poll() call.
+     */
+    CommandReactor(uint16_t maxEvents = DefaultReactorEvents);
+
+    /**
+     * @brief Destructor, the streams and managers are not closed.
+     */
+    ~CommandReactor();
+
+    /**
+     * @brief Gets whether the epoll instance was created.
+     *
+     * @return true if the reactor can be used.
+     */
+    bool isValid() const;
+
+    /**
+     * @brief Registers a manager and the stream it reads from.
+     *
+     * @param manager The manager, constructed with stream as its serial port.
+     * @param stream The stream to watch, a stream can only be registered with one reactor.
+     * @return true if registered.
+     */
+    bool add(SerialCommandManager* manager, FdStream* stream);
+
+    /**
+     * @brief Stops watching a stream.
+     *
+     * @param stream The stream registered with add().
+     * @return true if the stream was registered.
+     */
+    bool remove(FdStream* stream);
+
+    /**
+     * @brief Waits for streams to become ready and services their managers.
+     *
+     * Streams that reach end of file or report an error are removed, check FdStream::isOpen().
+     *
+     * @param timeoutMilliseconds Maximum time to wait, 0 returns immediately, -1 waits indefinitely.
+     * @return Number of streams serviced, -1 on error.
+     */
+    int poll(int timeoutMilliseconds);
+
+    /**
+     * @brief Sends queued output for a stream once its descriptor can accept it.
+     *
+     * Call after sending to a manager with a transmit buffer from outside a handler.
+     *
+     * @param stream The stream registered with add().
+     */
+    void watchOutput(FdStream* stream);
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include "ConcurrentStream.h"
+
+#if SCM_CONCURRENT
+
+#include <thread>
+
+// Frame being built by the current task/thread
+struct PendingFrame
+{
+    ConcurrentStream* owner;
+    uint32_t ownerId;           // 0 when there is no partial frame, the owner may since have been destroyed
+    uint16_t length;
+    bool oversized;             // overran ConcurrentFrameSize, discarded up to the terminator
+    char data[ConcurrentFrameSize];
+};
+
+static thread_local PendingFrame t_frame = { nullptr, 0, 0, false, { 0 } };
+
+// Streams not yet destroyed, a task only flushes another stream's partial frame while it is listed
+static std::atomic_flag s_liveLock = ATOMIC_FLAG_INIT;
+static ConcurrentStream* s_liveStreams = nullptr;
+static uint32_t s_nextId = 1;
+
+static void lockLive()
+{
+    while (s_liveLock.test_and_set(std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+static void unlockLive()
+{
+    s_liveLock.clear(std::memory_order_release);
+}
+
+static void resetPendingFrame()
+{
+    t_frame.owner = nullptr;
+    t_frame.ownerId = 0;
+    t_frame.length = 0;
+    t_frame.oversized = false;
+}
+
+ConcurrentStream::ConcurrentStream(Stream* port, uint8_t frameCount, char terminator)
+    : _port(port), _terminator(terminator), _enqueuePos(0), _droppedFrames(0)
+{
+    size_t capacity = 2;
+
+    while (capacity < frameCount)
+        capacity <<= 1;
+
+    _frames = new Frame[capacity];
+    _frameMask = capacity - 1;
+
+    for (size_t i = 0; i < capacity; i++)
+        _frames[i].sequence.store(i, std::memory_order_relaxed);
+
+    lockLive();
+    _id = s_nextId++;
+    _nextLive = s_liveStreams;
+    s_liveStreams = this;
+    unlockLive();
+}
+
+ConcurrentStream::~ConcurrentStream()
+{
+    // Other tasks' partial frames keep the id, they are discarded when those tasks next write
+    lockLive();
+
+    for (ConcurrentStream** link = &s_liveStreams; *link; link = &(*link)->_nextLive)
+    {
+        if (*link == this)
+        {
+            *link = _nextLive;
+            break;
+        }
+    }
+
+    unlockLive();
+
+    if (t_frame.ownerId == _id)
+        resetPendingFrame();
+
+    delete[] _frames;
+}
+
+void ConcurrentStream::flushOtherStream()
+{
+    // Held while flushing so the owner cannot be destroyed part way through
+    lockLive();
+
+    for (ConcurrentStream* stream = s_liveStreams; stream; stream = stream->_nextLive)
+    {
+        if (stream == t_frame.owner && stream->_id == t_frame.ownerId)
+        {
+            stream->flush();
+            break;
+        }
+    }
+
+    unlockLive();
+    resetPendingFrame();
+}
+
+bool ConcurrentStream::tryEnqueue(const char* data, uint16_t length)
+{
+    // Bounded multi-producer queue, each slot's sequence says whether it is free for this position
+    size_t position = _enqueuePos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        Frame& frame = _frames[position & _frameMask];
+        size_t sequence = frame.sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            if (_enqueuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                memcpy(frame.data, data, length);
+                frame.length = length;
+                frame.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = _enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void ConcurrentStream::enqueue(const char* data, uint16_t length)
+{
+    // Queue full, send (or wait for whichever task is sending) like a full hardware buffer
+    while (!tryEnqueue(data, length))
+    {
+        if (sendQueued() == 0)
+            std::this_thread::yield();
+    }
+}
+
+uint16_t ConcurrentStream::sendQueued()
+{
+    if (_sending.test_and_set(std::memory_order_acquire))
+        return 0;
+
+    uint16_t sent = 0;
+
+    for (;;)
+    {
+        Frame& frame = _frames[_dequeuePos & _frameMask];
+
+        if (frame.sequence.load(std::memory_order_acquire) != _dequeuePos + 1)
+            break;
+
+        _port->write(reinterpret_cast<const uint8_t*>(frame.data), frame.length);
+        frame.sequence.store(_dequeuePos + _frameMask + 1, std::memory_order_release);
+        _dequeuePos++;
+        sent++;
+    }
+
+    _sending.clear(std::memory_order_release);
+    return sent;
+}
+
+void ConcurrentStream::flush()
+{
+    if (t_frame.ownerId == _id)
+    {
+        if (t_frame.oversized)
+            _droppedFrames++;
+        else if (t_frame.length > 0)
+            enqueue(t_frame.data, t_frame.length);
+    }
+
+    resetPendingFrame();
+}
+
+uint32_t ConcurrentStream::getDroppedFrames() const
+{
+    return _droppedFrames.load(std::memory_order_relaxed);
+}
+
+int ConcurrentStream::available()
+{
+    return _port->available();
+}
+
+int ConcurrentStream::read()
+{
+    return _port->read();
+}
+
+int ConcurrentStream::peek()
+{
+    return _port->peek();
+}
+
+size_t ConcurrentStream::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ConcurrentStream::write(const uint8_t* buffer, size_t size)
+{
+    // A partial frame for another stream is completed first, ids rather than addresses are compared
+    // because a destroyed stream's address can be reused
+    if (t_frame.ownerId != _id)
+    {
+        if (t_frame.ownerId != 0)
+            flushOtherStream();
+
+        t_frame.owner = this;
+        t_frame.ownerId = _id;
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        char c = (char)buffer[i];
+
+        if (c == _terminator)
+        {
+            if (t_frame.oversized)
+            {
+                _droppedFrames++;
+            }
+            else
+            {
+                t_frame.data[t_frame.length++] = c;
+                enqueue(t_frame.data, t_frame.length);
+            }
+
+            t_frame.length = 0;
+            t_frame.oversized = false;
+        }
+        else if (t_frame.oversized)
+        {
+            continue;
+        }
+        else if (t_frame.length == ConcurrentFrameSize - 1)
+        {
+            // No room left for the terminator, sending it in parts would let other tasks' frames come between
+            t_frame.oversized = true;
+        }
+        else
+        {
+            t_frame.data[t_frame.length++] = c;
+        }
+    }
+
+    return size;
+}
+
+int ConcurrentStream::availableForWrite()
+{
+    return ConcurrentFrameSize;
+}
+
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+#include <Arduino.h>
+#include <SerialCommandManager.h>
+
+#if SCM_CONCURRENT
+
+const uint16_t ConcurrentFrameSize = 256;
+const uint8_t DefaultConcurrentFrames = 16;
+
+/**
+ * @brief Stream wrapper that lets several tasks/threads send through one SerialCommandManager.
+ *
+ * Bytes written by a task are collected in a buffer private to that task until the terminator
+ * is written, the complete frame is then placed on a lock-free multi-producer queue. Frames are
+ * written to the wrapped port by sendQueued(), only one task writes to the port at a time, so
+ * messages from different tasks never interleave. Reading is passed straight through and must
+ * only be done by one task, the one calling SerialCommandManager::readCommands().
+ *
+ * The transmit buffer, rate limiting and log buffer of the manager are not thread safe and should
+ * not be used with a ConcurrentStream. A frame longer than ConcurrentFrameSize cannot be queued
+ * whole, it is dropped rather than sent in parts that other tasks' frames could come between, and
+ * counted by getDroppedFrames(). Destroying a stream discards the partial frames other tasks were
+ * still building for it.
+ *
+ * Example (ESP32):
+ * `
+ * ConcurrentStream port(&Serial);
+ * SerialCommandManager commandMgr(&port, nullptr);
+ *
+ * void rxTask(void*)
+ * {
+ *     for (;;)
+ *     {
+ *         commandMgr.readCommands();
+ *         port.sendQueued();
+ *         vTaskDelay(1);
+ *     }
+ * }
+ *
+ * void sensorTask(void*)
+ * {
+ *     commandMgr.sendCommand("TEMP", "21.5");   // safe from any task
+ * }
+ * `
+ */
+class ConcurrentStream : public Stream
+{
+private:
+    struct Frame
+    {
+        std::atomic<size_t> sequence;
+        uint16_t length;
+        char data[ConcurrentFrameSize];
+    };
+
+    Stream* _port;
+    char _terminator;
+    Frame* _frames;
+    size_t _frameMask;
+    std::atomic<size_t> _enqueuePos;
+    size_t _dequeuePos = 0;                 // only changed while _sending is held
+    std::atomic_flag _sending = ATOMIC_FLAG_INIT;
+    std::atomic<uint32_t> _droppedFrames;
+    uint32_t _id;                           // never reused, a task's partial frame records it
+    ConcurrentStream* _nextLive;            // list of streams not yet destroyed
+
+    /**
+     * @brief Completes the calling task's partial frame for another stream, discarding it if that stream was destroyed.
+     */
+    static void flushOtherStream();
+
+    /**
+     * @brief Adds a frame to the queue, sending queued frames or waiting if it is full.
+     */
+    void enqueue(const char* data, uint16_t length);
+
+    /**
+     * @brief Adds a frame to the queue if there is room.
+     *
+     * @return false if the queue is full.
+     */
+    bool tryEnqueue(const char* data, uint16_t length);
+
+public:
+    /**
+     * @brief Constructs a stream sending through port.
+     *
+     * @param port The serial port to wrap.
+     * @param frameCount Number of complete frames that can be queued, rounded up to a power of 2.
+     * @param terminator Message terminator, must match the SerialCommandManager.
+     */
+    ConcurrentStream(Stream* port, uint8_t frameCount = DefaultConcurrentFrames, char terminator = '\n');
+
+    /**
+     * @brief Destructor, queued frames that have not been sent and partial frames of any task are discarded.
+     */
+    ~ConcurrentStream();
+
+    /**
+     * @brief Writes queued frames to the port.
+     *
+     * Call regularly, usually from the task reading commands. Returns immediately if another task
+     * is already sending.
+     *
+     * @return Number of frames written.
+     */
+    uint16_t sendQueued();
+
+    /**
+     * @brief Completes the calling task's partial frame, if any, and queues it.
+     */
+    void flush() override;
+
+    /**
+     * @brief Gets the number of frames dropped for being longer than ConcurrentFrameSize.
+     *
+     * @return Dropped frame count since construction.
+     */
+    uint32_t getDroppedFrames() const;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int availableForWrite() override;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "DeferredDispatchHandler.h"
+
+#if SCM_CONCURRENT
+
+DeferredDispatchHandler::DeferredDispatchHandler(const SerialCommandRegistry* registry, uint8_t queueLength)
+    : _registry(registry), _head(0), _tail(0)
+{
+    // One slot is kept empty to tell a full queue from an empty one
+    _jobCount = (uint8_t)(queueLength < 255 ? queueLength + 1 : 255);
+    _jobs = new Job[_jobCount];
+}
+
+DeferredDispatchHandler::~DeferredDispatchHandler()
+{
+    delete[] _jobs;
+}
+
+bool DeferredDispatchHandler::handleCommand(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount)
+{
+    uint8_t head = _head.load(std::memory_order_relaxed);
+    uint8_t next = (uint8_t)((head + 1) % _jobCount);
+
+    if (next == _tail.load(std::memory_order_acquire))
+    {
+        sender->sendAck(command, F("busy"));
+        return true;
+    }
+
+    // The manager reuses its parser buffers for the next message, so the command is copied
+    Job& job = _jobs[head];
+    job.sender = sender;
+    strncpy(job.command, command, DefaultMaxCommandLength);
+    job.command[DefaultMaxCommandLength] = '\0';
+
+    if (paramCount > MaximumParameterCount)
+        paramCount = MaximumParameterCount;
+
+    for (uint8_t i = 0; i < paramCount; i++)
+        job.params[i] = params[i];
+
+    job.paramCount = paramCount;
+
+    // The reader replaces the manager's id with the next message's, the worker echoes this copy
+    strncpy(job.correlationId, sender->getCorrelationId(), CorrelationIdLength);
+    job.correlationId[CorrelationIdLength] = '\0';
+
+    _head.store(next, std::memory_order_release);
+    return true;
+}
+
+uint8_t DeferredDispatchHandler::runPending()
+{
+    uint8_t run = 0;
+    uint8_t tail = _tail.load(std::memory_order_relaxed);
+
+    while (tail != _head.load(std::memory_order_acquire))
+    {
+        Job& job = _jobs[tail];
+        SerialCommandManager::setTaskCorrelationId(job.correlationId);
+        _registry->dispatch(job.sender, job.command, job.params, job.paramCount);
+        SerialCommandManager::setTaskCorrelationId(nullptr);
+
+        tail = (uint8_t)((tail + 1) % _jobCount);
+        _tail.store(tail, std::memory_order_release);
+        run++;
+    }
+
+    return run;
+}
+
+uint8_t DeferredDispatchHandler::getPending() const
+{
+    uint8_t head = _head.load(std::memory_order_acquire);
+    uint8_t tail = _tail.load(std::memory_order_acquire);
+
+    return (uint8_t)((head + _jobCount - tail) % _jobCount);
+}
+
+const char* const* DeferredDispatchHandler::supportedCommands(size_t& count) const
+{
+    // Matching is delegated to the registry, see supportsCommand()
+    count = 0;
+    return nullptr;
+}
+
+bool DeferredDispatchHandler::supportsCommand(const char* command) const
+{
+    if (!_registry)
+        return false;
+
+    for (size_t i = 0; i < _registry->getHandlerCount(); i++)
+    {
+        if (_registry->getHandler(i)->supportsCommand(command))
+            return true;
+    }
+
+    return false;
+}
+
+#endif
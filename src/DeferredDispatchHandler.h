@@ -0,0 +1,86 @@
+#pragma once
+#include <Arduino.h>
+#include <SerialCommandManager.h>
+
+#if SCM_CONCURRENT
+
+const uint8_t DefaultDeferredCommands = 4;
+
+/**
+ * @brief Hands commands to a worker task instead of running handlers on the receiving task.
+ *
+ * Register it with the manager in place of the real handlers. When a command supported by the
+ * registry arrives it is copied, with its parameters, to a lock-free queue and the receiving task
+ * carries on parsing. The worker task calls runPending() to run the handlers, which reply through
+ * the manager as usual, use a ConcurrentStream so replies from the worker do not interleave.
+ * If the queue is full the command is answered with ACK:<command>=busy. The correlation id is
+ * queued with the command, replies the handler sends while runPending() runs it echo that id.
+ *
+ * Example:
+ * `
+ * DeferredDispatchHandler deferred(&registry);
+ * ISerialCommandHandler* handlers[] = { &deferred };
+ * commandMgr.registerHandlers(handlers, 1);
+ *
+ * void workerTask(void*)
+ * {
+ *     for (;;)
+ *     {
+ *         deferred.runPending();
+ *         vTaskDelay(1);
+ *     }
+ * }
+ * `
+ */
+class DeferredDispatchHandler : public ISerialCommandHandler
+{
+private:
+    struct Job
+    {
+        SerialCommandManager* sender;
+        char command[DefaultMaxCommandLength + 1];
+        StringKeyValue params[MaximumParameterCount];
+        uint8_t paramCount;
+        char correlationId[CorrelationIdLength + 1];
+    };
+
+    const SerialCommandRegistry* _registry;
+    Job* _jobs;
+    uint8_t _jobCount;
+    std::atomic<uint8_t> _head;     // next job written by the receiving task
+    std::atomic<uint8_t> _tail;     // next job run by the worker
+
+public:
+    /**
+     * @brief Constructs a handler deferring the commands of a registry.
+     *
+     * @param registry The handlers run by the worker, must outlive this object.
+     * @param queueLength Maximum number of commands waiting for the worker.
+     */
+    DeferredDispatchHandler(const SerialCommandRegistry* registry, uint8_t queueLength = DefaultDeferredCommands);
+
+    /**
+     * @brief Destructor, commands not yet run are discarded.
+     */
+    ~DeferredDispatchHandler();
+
+    /**
+     * @brief Runs queued commands, call from the worker task only.
+     *
+     * @return Number of commands run.
+     */
+    uint8_t runPending();
+
+    /**
+     * @brief Gets the number of commands waiting for the worker.
+     *
+     * @return Queued command count.
+     */
+    uint8_t getPending() const;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount) override;
+    const char* const* supportedCommands(size_t& count) const override;
+    bool supportsCommand(const char* command) const override;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "FdStream.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Maximum reported by availableForWrite(), writes beyond what the descriptor accepts return short
+const int FdStreamWriteRoom = 4096;
+
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static speed_t baudToSpeed(unsigned long baud)
+{
+    switch (baud)
+    {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        default: return B0;
+    }
+}
+
+FdStream::FdStream()
+    : _fd(-1), _ownsFd(false), _isOpen(false), _writeTimeout(DefaultFdWriteTimeout)
+{
+}
+
+FdStream::FdStream(int fd, bool ownsFd, int writeTimeoutMilliseconds)
+    : _fd(-1), _ownsFd(false), _isOpen(false), _writeTimeout(writeTimeoutMilliseconds)
+{
+    attach(fd, ownsFd);
+}
+
+FdStream::~FdStream()
+{
+    close();
+}
+
+bool FdStream::attach(int fd, bool ownsFd)
+{
+    close();
+
+    _fd = fd;
+    _ownsFd = ownsFd;
+    _isOpen = fd >= 0 && setNonBlocking(fd);
+    return _isOpen;
+}
+
+bool FdStream::openTty(const char* path, unsigned long baud)
+{
+    speed_t speed = baudToSpeed(baud);
+
+    if (!path || speed == B0)
+        return false;
+
+    int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (fd < 0)
+        return false;
+
+    struct termios options;
+
+    if (tcgetattr(fd, &options) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    cfmakeraw(&options);
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    options.c_cflag |= CLOCAL | CREAD;
+
+    if (tcsetattr(fd, TCSANOW, &options) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    return attach(fd, true);
+}
+
+void FdStream::close()
+{
+    if (_fd >= 0 && _ownsFd)
+        ::close(_fd);
+
+    _fd = -1;
+    _ownsFd = false;
+    _isOpen = false;
+    _readPos = 0;
+    _readLength = 0;
+}
+
+int FdStream::getFd() const
+{
+    return _fd;
+}
+
+bool FdStream::isOpen() const
+{
+    return _isOpen;
+}
+
+void FdStream::setWriteTimeout(int milliseconds)
+{
+    _writeTimeout = milliseconds;
+}
+
+uint16_t FdStream::fill()
+{
+    if (_readPos < _readLength || !_isOpen)
+        return _readLength - _readPos;
+
+    _readPos = 0;
+    _readLength = 0;
+
+    ssize_t count = ::read(_fd, _readBuffer, sizeof(_readBuffer));
+
+    if (count > 0)
+        _readLength = (uint16_t)count;
+    else if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        _isOpen = false;    // end of file, hangup or error
+
+    return _readLength;
+}
+
+int FdStream::available()
+{
+    return fill();
+}
+
+int FdStream::read()
+{
+    if (fill() == 0)
+        return -1;
+
+    return _readBuffer[_readPos++];
+}
+
+int FdStream::peek()
+{
+    if (fill() == 0)
+        return -1;
+
+    return _readBuffer[_readPos];
+}
+
+size_t FdStream::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t FdStream::write(const uint8_t* buffer, size_t size)
+{
+    size_t written = 0;
+
+    while (_isOpen && written < size)
+    {
+        ssize_t count = ::write(_fd, buffer + written, size - written);
+
+        if (count > 0)
+        {
+            written += (size_t)count;
+            continue;
+        }
+
+        if (count < 0 && errno == EINTR)
+            continue;
+
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            _isOpen = false;
+            break;
+        }
+
+        // Full, wait like a hardware serial port would
+        struct pollfd pending = { _fd, POLLOUT, 0 };
+
+        if (_writeTimeout <= 0 || ::poll(&pending, 1, _writeTimeout) <= 0)
+            break;
+    }
+
+    return written;
+}
+
+int FdStream::availableForWrite()
+{
+    return _isOpen ? FdStreamWriteRoom : 0;
+}
+
+#endif
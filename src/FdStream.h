@@ -0,0 +1,124 @@
+#pragma once
+
+// Native POSIX hosts only, e.g. Linux gateways driving USB-serial devices
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <Arduino.h>
+#include <SerialCommandManager.h>
+
+const uint16_t FdStreamReadBufferSize = 256;
+const int DefaultFdWriteTimeout = 1000;
+
+/**
+ * @brief Stream over a POSIX file descriptor: tty, pty, pipe or socket.
+ *
+ * The descriptor is switched to non-blocking mode. Reads are buffered so SerialCommandManager's
+ * byte at a time parsing costs one read() system call per buffer rather than per byte. Writes
+ * behave like a hardware serial port, waiting (up to the write timeout) when the descriptor
+ * cannot accept more data.
+ *
+ * Example:
+ * `
+ * FdStream port;
+ * port.openTty("/dev/ttyUSB0", 115200);
+ * SerialCommandManager commandMgr(&port, nullptr);
+ * `
+ */
+class FdStream : public Stream
+{
+    friend class CommandReactor;
+
+private:
+    int _fd;
+    bool _ownsFd;
+    bool _isOpen;
+    int _writeTimeout;
+    uint8_t _readBuffer[FdStreamReadBufferSize];
+    uint16_t _readPos = 0;
+    uint16_t _readLength = 0;
+
+    // Used by CommandReactor while the stream is registered
+    SerialCommandManager* _manager = nullptr;
+    FdStream* _nextRegistered = nullptr;
+    bool _watchingOutput = false;
+
+    /**
+     * @brief Refills the read buffer from the descriptor if it is empty.
+     *
+     * @return Number of buffered bytes.
+     */
+    uint16_t fill();
+
+public:
+    /**
+     * @brief Constructs a stream with no descriptor, see attach() and openTty().
+     */
+    FdStream();
+
+    /**
+     * @brief Constructs a stream over an open descriptor.
+     *
+     * @param fd The file descriptor.
+     * @param ownsFd true to close the descriptor when the stream is closed or destroyed.
+     * @param writeTimeoutMilliseconds Maximum time a write waits for the descriptor to accept data.
+     */
+    FdStream(int fd, bool ownsFd = false, int writeTimeoutMilliseconds = DefaultFdWriteTimeout);
+
+    /**
+     * @brief Destructor, closes the descriptor if owned.
+     */
+    ~FdStream();
+
+    /**
+     * @brief Uses an open descriptor, closing any current one.
+     *
+     * @param fd The file descriptor.
+     * @param ownsFd true to close the descriptor when the stream is closed or destroyed.
+     * @return true if the descriptor could be made non-blocking.
+     */
+    bool attach(int fd, bool ownsFd = false);
+
+    /**
+     * @brief Opens a serial device in raw 8N1 mode.
+     *
+     * @param path Device path, e.g. "/dev/ttyUSB0".
+     * @param baud Baud rate, e.g. 115200.
+     * @return true if the device was opened and configured.
+     */
+    bool openTty(const char* path, unsigned long baud);
+
+    /**
+     * @brief Closes the descriptor if owned and detaches it.
+     */
+    void close();
+
+    /**
+     * @brief Gets the file descriptor.
+     *
+     * @return The descriptor, -1 if none.
+     */
+    int getFd() const;
+
+    /**
+     * @brief Gets whether the descriptor is usable, false after end of file or an error.
+     *
+     * @return true if open.
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Sets the maximum time a write waits for the descriptor to accept data.
+     *
+     * @param milliseconds Timeout, 0 writes only what can be written immediately.
+     */
+    void setWriteTimeout(int milliseconds);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int availableForWrite() override;
+};
+
+#endif
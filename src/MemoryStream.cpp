@@ -0,0 +1,241 @@
+#include "MemoryStream.h"
+
+// Line time of one 8N1 byte in bit microseconds: 10 bits, each 1000000 / baud microseconds
+const uint64_t ByteLineTime = 10ULL * 1000000ULL;
+
+#if !SCM_NO_HEAP
+MemoryStream::MemoryStream(uint16_t rxCapacity, uint16_t txCapacity)
+    : _ownsStorage(true)
+{
+    initRing(_rx, new uint8_t[rxCapacity], rxCapacity);
+    initRing(_tx, new uint8_t[txCapacity], txCapacity);
+}
+#endif
+
+MemoryStream::MemoryStream(uint8_t* rxStorage, uint16_t rxCapacity, uint8_t* txStorage, uint16_t txCapacity)
+    : _ownsStorage(false)
+{
+    initRing(_rx, rxStorage, rxCapacity);
+    initRing(_tx, txStorage, txCapacity);
+}
+
+MemoryStream::~MemoryStream()
+{
+#if !SCM_NO_HEAP
+    if (_ownsStorage)
+    {
+        delete[] _rx.data;
+        delete[] _tx.data;
+    }
+#endif
+}
+
+void MemoryStream::initRing(Ring& ring, uint8_t* data, uint16_t capacity)
+{
+    ring.data = data;
+    ring.capacity = data ? capacity : 0;
+    ring.head = 0;
+    ring.count = 0;
+    ring.ready = 0;
+}
+
+size_t MemoryStream::push(Ring& ring, const uint8_t* buffer, size_t size, bool paced)
+{
+    size_t room = ring.capacity - ring.count;
+
+    if (size > room)
+        size = room;
+
+    if (size == 0)
+        return 0;
+
+    // Copy in at most two runs, up to the end of the storage and then from its start
+    uint16_t tail = (uint16_t)((ring.head + ring.count) % ring.capacity);
+    size_t first = ring.capacity - tail;
+
+    if (first > size)
+        first = size;
+
+    memcpy(ring.data + tail, buffer, first);
+    memcpy(ring.data, buffer + first, size - first);
+
+    ring.count += (uint16_t)size;
+
+    if (!paced)
+        ring.ready = ring.count;
+
+    return size;
+}
+
+size_t MemoryStream::pop(Ring& ring, uint8_t* buffer, size_t size)
+{
+    if (size > ring.ready)
+        size = ring.ready;
+
+    if (size == 0)
+        return 0;
+
+    size_t first = ring.capacity - ring.head;
+
+    if (first > size)
+        first = size;
+
+    memcpy(buffer, ring.data + ring.head, first);
+    memcpy(buffer + first, ring.data, size - first);
+
+    ring.head = (uint16_t)((ring.head + size) % ring.capacity);
+    ring.count -= (uint16_t)size;
+    ring.ready -= (uint16_t)size;
+    return size;
+}
+
+void MemoryStream::release(Ring& ring, uint64_t& line, uint32_t elapsedMicros, uint32_t baud)
+{
+    // An idle line banks no time towards bytes written later
+    if (ring.ready == ring.count)
+    {
+        line = 0;
+        return;
+    }
+
+    line += (uint64_t)elapsedMicros * baud;
+
+    uint64_t bytes = line / ByteLineTime;
+    uint16_t waiting = ring.count - ring.ready;
+
+    if (bytes >= waiting)
+    {
+        ring.ready = ring.count;
+        line = 0;
+    }
+    else
+    {
+        ring.ready += (uint16_t)bytes;
+        line -= bytes * ByteLineTime;
+    }
+}
+
+size_t MemoryStream::inject(const uint8_t* buffer, size_t size)
+{
+    return push(_rx, buffer, size, _baud > 0);
+}
+
+size_t MemoryStream::inject(const char* text)
+{
+    return text ? inject(reinterpret_cast<const uint8_t*>(text), strlen(text)) : 0;
+}
+
+size_t MemoryStream::extract(uint8_t* buffer, size_t size)
+{
+    return pop(_tx, buffer, size);
+}
+
+void MemoryStream::clear()
+{
+    initRing(_rx, _rx.data, _rx.capacity);
+    initRing(_tx, _tx.data, _tx.capacity);
+    _rxLine = 0;
+    _txLine = 0;
+    _overflow = 0;
+}
+
+uint32_t MemoryStream::getOverflow() const
+{
+    return _overflow;
+}
+
+uint16_t MemoryStream::pendingOutput() const
+{
+    return _tx.count;
+}
+
+void MemoryStream::setLoopback(bool enabled)
+{
+    _loopback = enabled;
+}
+
+void MemoryStream::setBaudRate(uint32_t baud)
+{
+    _baud = baud;
+
+    // Bytes already queued are delivered at once when pacing is turned off
+    if (baud == 0)
+    {
+        _rx.ready = _rx.count;
+        _tx.ready = _tx.count;
+    }
+}
+
+void MemoryStream::advance(uint32_t elapsedMicros)
+{
+    _clockMicros += elapsedMicros;
+
+    if (_baud == 0)
+        return;
+
+    release(_rx, _rxLine, elapsedMicros, _baud);
+    release(_tx, _txLine, elapsedMicros, _baud);
+}
+
+uint32_t MemoryStream::clockMicros() const
+{
+    return _clockMicros;
+}
+
+uint32_t MemoryStream::clockMillis() const
+{
+    return _clockMicros / 1000;
+}
+
+size_t MemoryStream::readBytes(char* buffer, size_t length)
+{
+    return pop(_rx, reinterpret_cast<uint8_t*>(buffer), length);
+}
+
+size_t MemoryStream::readBytes(uint8_t* buffer, size_t length)
+{
+    return pop(_rx, buffer, length);
+}
+
+int MemoryStream::available()
+{
+    return _rx.ready;
+}
+
+int MemoryStream::read()
+{
+    if (_rx.ready == 0)
+        return -1;
+
+    uint8_t c = _rx.data[_rx.head];
+
+    _rx.head = (uint16_t)((_rx.head + 1) % _rx.capacity);
+    _rx.count--;
+    _rx.ready--;
+    return c;
+}
+
+int MemoryStream::peek()
+{
+    return _rx.ready > 0 ? _rx.data[_rx.head] : -1;
+}
+
+size_t MemoryStream::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t MemoryStream::write(const uint8_t* buffer, size_t size)
+{
+    size_t written = push(_loopback ? _rx : _tx, buffer, size, _baud > 0);
+
+    _overflow += (uint32_t)(size - written);
+    return written;
+}
+
+int MemoryStream::availableForWrite()
+{
+    Ring& ring = _loopback ? _rx : _tx;
+
+    return ring.capacity - ring.count;
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include <Arduino.h>
+#include <SerialCommandManager.h>
+
+const uint16_t DefaultMemoryStreamCapacity = 256;
+
+/**
+ * @brief Stream over two in-memory ring buffers, for native tests, benchmarks and on device self tests.
+ *
+ * The receive ring holds bytes written with inject() for the manager to read, the transmit ring holds
+ * what the manager writes until collected with extract(). availableForWrite() reports the free transmit
+ * space, so a small ring or an idle host exercises the same backpressure paths as a slow serial port.
+ *
+ * With setBaudRate() bytes travel at line speed on a virtual clock moved by advance(): injected bytes
+ * become readable, and written bytes collectable, only as the clock passes their transfer time. Single
+ * byte and bulk writes are paced alike, with setLoopback() written bytes cross the receive line.
+ * clockMillis() is the clock to report from millis() so timeouts run on the same time line, e.g.
+ * `When(Method(ArduinoFake(), millis)).AlwaysReturn(stream.clockMillis())` after each advance().
+ *
+ * Example:
+ * `
+ * MemoryStream stream;
+ * SerialCommandManager commandMgr(&stream, nullptr);
+ * stream.inject("LED:on\n");
+ * commandMgr.readCommands();
+ * `
+ */
+class MemoryStream : public Stream
+{
+private:
+    struct Ring
+    {
+        uint8_t* data;
+        uint16_t capacity;
+        uint16_t head;      // next byte to read
+        uint16_t count;     // bytes stored
+        uint16_t ready;     // bytes at the head that have crossed the line, count without pacing
+    };
+
+    Ring _rx;
+    Ring _tx;
+    bool _ownsStorage;
+    bool _loopback = false;
+    uint32_t _baud = 0;
+    uint32_t _clockMicros = 0;
+    uint64_t _rxLine = 0;           // line time carried towards the next receive byte, in bit microseconds
+    uint64_t _txLine = 0;
+    uint32_t _overflow = 0;
+
+    static void initRing(Ring& ring, uint8_t* data, uint16_t capacity);
+    static size_t push(Ring& ring, const uint8_t* buffer, size_t size, bool paced);
+    static size_t pop(Ring& ring, uint8_t* buffer, size_t size);
+    static void release(Ring& ring, uint64_t& line, uint32_t elapsedMicros, uint32_t baud);
+
+public:
+    /**
+     * @brief Constructs a stream with allocated rings.
+     *
+     * @param rxCapacity Receive ring size in bytes.
+     * @param txCapacity Transmit ring size in bytes.
+     */
+    MemoryStream(uint16_t rxCapacity = DefaultMemoryStreamCapacity, uint16_t txCapacity = DefaultMemoryStreamCapacity)
+#if SCM_NO_HEAP
+        = delete
+#endif
+        ;
+
+    /**
+     * @brief Constructs a stream over caller provided rings, which must outlive it.
+     *
+     * @param rxStorage Receive ring storage.
+     * @param rxCapacity Size of rxStorage.
+     * @param txStorage Transmit ring storage.
+     * @param txCapacity Size of txStorage.
+     */
+    MemoryStream(uint8_t* rxStorage, uint16_t rxCapacity, uint8_t* txStorage, uint16_t txCapacity);
+
+    /**
+     * @brief Destructor, releases allocated rings.
+     */
+    ~MemoryStream();
+
+    MemoryStream(const MemoryStream&) = delete;
+    MemoryStream& operator=(const MemoryStream&) = delete;
+
+    /**
+     * @brief Queues bytes for the manager to read.
+     *
+     * @param buffer Bytes to queue.
+     * @param size Number of bytes.
+     * @return Bytes queued, fewer than size when the receive ring is full.
+     */
+    size_t inject(const uint8_t* buffer, size_t size);
+
+    /**
+     * @brief Queues a null-terminated string for the manager to read.
+     *
+     * @param text String to queue.
+     * @return Bytes queued, fewer than its length when the receive ring is full.
+     */
+    size_t inject(const char* text);
+
+    /**
+     * @brief Collects bytes the manager wrote.
+     *
+     * @param buffer Destination.
+     * @param size Size of buffer.
+     * @return Bytes copied, only those that have crossed the line when paced.
+     */
+    size_t extract(uint8_t* buffer, size_t size);
+
+    /**
+     * @brief Discards everything in both rings and resets the overflow count.
+     */
+    void clear();
+
+    /**
+     * @brief Gets the bytes written that the transmit ring had no room for.
+     *
+     * @return Dropped byte count since construction or clear().
+     */
+    uint32_t getOverflow() const;
+
+    /**
+     * @brief Gets the bytes waiting to be collected with extract(), including those still on the line.
+     *
+     * @return Bytes in the transmit ring.
+     */
+    uint16_t pendingOutput() const;
+
+    /**
+     * @brief Sends what is written straight back to the receive ring, e.g. to parse one's own output.
+     *
+     * @param enabled true to loop writes back, false to collect them with extract().
+     */
+    void setLoopback(bool enabled);
+
+    /**
+     * @brief Paces both directions at a line speed of 10 bits per byte (8N1).
+     *
+     * @param baud Bits per second, 0 (the default) makes bytes available immediately.
+     */
+    void setBaudRate(uint32_t baud);
+
+    /**
+     * @brief Moves the virtual clock forward, delivering the bytes the line carries in that time.
+     *
+     * @param elapsedMicros Time to advance in microseconds.
+     */
+    void advance(uint32_t elapsedMicros);
+
+    /**
+     * @brief Gets the virtual clock.
+     *
+     * @return Microseconds advanced since construction.
+     */
+    uint32_t clockMicros() const;
+
+    /**
+     * @brief Gets the virtual clock in milliseconds, the value millis() should report.
+     *
+     * @return Milliseconds advanced since construction.
+     */
+    uint32_t clockMillis() const;
+
+    /**
+     * @brief Reads up to length received bytes without waiting.
+     *
+     * @param buffer Destination.
+     * @param length Size of buffer.
+     * @return Bytes read.
+     */
+    size_t readBytes(char* buffer, size_t length);
+    size_t readBytes(uint8_t* buffer, size_t length);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int availableForWrite() override;
+};
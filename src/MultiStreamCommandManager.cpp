@@ -0,0 +1,65 @@
+#include "MultiStreamCommandManager.h"
+
+MultiStreamCommandManager::MultiStreamCommandManager(SerialCommandManager** managers, uint8_t managerCount, uint16_t bytesPerPoll)
+{
+    _managers = managers;
+    _managerCount = managers ? managerCount : 0;
+    _bytesPerPoll = bytesPerPoll;
+}
+
+void MultiStreamCommandManager::registerHandlers(ISerialCommandHandler** handlers, size_t handlerCount)
+{
+    if (_managerCount == 0)
+        return;
+
+    // The first manager copies the array, the rest share its registry
+    SerialCommandManager* owner = _managers[0];
+    owner->registerHandlers(handlers, handlerCount);
+
+    for (uint8_t i = 1; i < _managerCount; i++)
+    {
+        _managers[i]->setRegistry(owner->getRegistry());
+    }
+}
+
+void MultiStreamCommandManager::setRegistry(const SerialCommandRegistry* registry)
+{
+    for (uint8_t i = 0; i < _managerCount; i++)
+    {
+        _managers[i]->setRegistry(registry);
+    }
+}
+
+void MultiStreamCommandManager::readCommands()
+{
+    if (_managerCount == 0)
+        return;
+
+    // Start with a different stream each time so no stream is always served last
+    uint8_t first = _nextManager;
+
+    for (uint8_t i = 0; i < _managerCount; i++)
+    {
+        _managers[(first + i) % _managerCount]->readCommands(_bytesPerPoll);
+    }
+
+    _nextManager = (uint8_t)((first + 1) % _managerCount);
+}
+
+void MultiStreamCommandManager::setBytesPerPoll(uint16_t bytesPerPoll)
+{
+    _bytesPerPoll = bytesPerPoll;
+}
+
+SerialCommandManager* MultiStreamCommandManager::getManager(uint8_t index)
+{
+    if (index >= _managerCount)
+        return nullptr;
+
+    return _managers[index];
+}
+
+uint8_t MultiStreamCommandManager::getManagerCount()
+{
+    return _managerCount;
+}
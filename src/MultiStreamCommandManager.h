@@ -0,0 +1,93 @@
+#pragma once
+#include <Arduino.h>
+#include <SerialCommandManager.h>
+
+const uint16_t DefaultBytesPerPoll = 32;
+
+/**
+ * @brief Services several streams, each with its own SerialCommandManager, from one handler array.
+ *
+ * Each stream keeps its own parser state, buffers, debug flag and transmit buffer, configured on
+ * its SerialCommandManager as usual. Handlers are registered once and shared by every stream, and
+ * because a handler is passed the SerialCommandManager that received the command, replies go back
+ * to the stream the command arrived on.
+ *
+ * readCommands() reads at most a fixed number of bytes from each stream in turn, starting with a
+ * different stream on each call, so a busy port cannot starve the others.
+ *
+ * Example:
+ * `
+ * SerialCommandManager hostMgr(&Serial, nullptr);
+ * SerialCommandManager displayMgr(&Serial1, nullptr);
+ * SerialCommandManager* managers[] = { &hostMgr, &displayMgr };
+ * MultiStreamCommandManager commandMgr(managers, 2);
+ *
+ * commandMgr.registerHandlers(handlers, 3);   // in setup()
+ * commandMgr.readCommands();                  // in loop()
+ * `
+ */
+class MultiStreamCommandManager
+{
+private:
+    SerialCommandManager** _managers;
+    uint8_t _managerCount;
+    uint8_t _nextManager = 0;
+    uint16_t _bytesPerPoll;
+
+public:
+    /**
+     * @brief Constructs a manager servicing the streams of existing SerialCommandManager instances.
+     *
+     * The array is not copied and must remain valid for the lifetime of this object.
+     *
+     * @param managers Array of pointers to SerialCommandManager objects, one per stream.
+     * @param managerCount Number of managers in the array.
+     * @param bytesPerPoll Maximum bytes read from each stream per readCommands() call, 0 for no limit.
+     */
+    MultiStreamCommandManager(SerialCommandManager** managers, uint8_t managerCount, uint16_t bytesPerPoll = DefaultBytesPerPoll);
+
+    /**
+     * @brief Registers an array of command handler objects with every stream.
+     *
+     * A single handler array is built and shared, it is owned by the first manager so handlers
+     * should not be registered directly on the individual managers afterwards.
+     *
+     * @param handlers Array of pointers to ISerialCommandHandler objects.
+     * @param handlerCount Number of handlers in the array.
+     */
+    void registerHandlers(ISerialCommandHandler** handlers, size_t handlerCount);
+
+    /**
+     * @brief Uses a shared registry of command handlers on every stream.
+     *
+     * @param registry The handlers to dispatch commands to, must outlive the managers.
+     */
+    void setRegistry(const SerialCommandRegistry* registry);
+
+    /**
+     * @brief Reads and processes incoming commands from every stream, round-robin.
+     */
+    void readCommands();
+
+    /**
+     * @brief Sets the maximum number of bytes read from each stream per readCommands() call.
+     *
+     * @param bytesPerPoll Byte budget per stream, 0 for no limit.
+     */
+    void setBytesPerPoll(uint16_t bytesPerPoll);
+
+    /**
+     * @brief Gets the manager servicing a stream.
+     *
+     * @param index Index of the stream.
+     * @return The manager, nullptr if index is out of range.
+     */
+    SerialCommandManager* getManager(uint8_t index);
+
+    /**
+     * @brief Gets the number of streams being serviced.
+     *
+     * @return Stream count.
+     */
+    uint8_t getManagerCount();
+};
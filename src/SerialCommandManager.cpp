@@ -1,3 +1,4 @@
+#include <stdarg.h>
 #include "SerialCommandManager.h"
 
 // ============================================================================
@@ -50,36 +51,132 @@
     }
 
     /**
-     * @brief Removes trailing terminators (CR/LF) from a string.
+     * @brief Returns the length of a string, limited to maxLen, ignoring trailing terminators (CR/LF).
      */
-    static void removeTrailingTerminators(char* str) {
-        if (!str) return;
-        
-        size_t len = strlen(str);
+    static size_t trimmedLength(const char* str, size_t maxLen) {
+        if (!str) return 0;
+
+        size_t len = 0;
+        while (len < maxLen && str[len] != '\0') {
+            len++;
+        }
+
         while (len > 0 && (str[len - 1] == '\n' || str[len - 1] == '\r')) {
-            str[len - 1] = '\0';
             len--;
         }
+
+        return len;
     }
 
     /**
-     * @brief Finds the first occurrence of a character in a string.
-     * @return Index of character, or -1 if not found.
+     * @brief Writes the decimal digits of an unsigned value into a buffer (null terminated).
+     * @return Number of digits written, buffer must hold the digits plus a terminator (21 for any unsigned long).
      */
-    static int16_t findChar(const char* str, char c) {
-        if (!str) return -1;
-        
-        const char* pos = strchr(str, c);
-        return pos ? (pos - str) : -1;
+    static uint8_t formatUnsigned(char* buffer, unsigned long value) {
+        char digits[20];
+        uint8_t count = 0;
+
+        do {
+            digits[count++] = (char)('0' + (value % 10));
+            value /= 10;
+        } while (value > 0);
+
+        for (uint8_t i = 0; i < count; ++i)
+            buffer[i] = digits[count - 1 - i];
+
+        buffer[count] = '\0';
+        return count;
+    }
+
+    /**
+     * @brief Writes the decimal digits of a signed value into a buffer (null terminated).
+     * @return Number of characters written including any '-' sign.
+     */
+    static uint8_t formatSigned(char* buffer, long value) {
+        if (value < 0) {
+            buffer[0] = '-';
+            return 1 + formatUnsigned(buffer + 1, 0UL - (unsigned long)value);
+        }
+
+        return formatUnsigned(buffer, (unsigned long)value);
+    }
+
+    /**
+     * @brief Writes the hexadecimal digits of an unsigned value into a buffer (null terminated).
+     * @return Number of digits written.
+     */
+    static uint8_t formatHex(char* buffer, unsigned long value, bool upperCase) {
+        const char* hexDigits = upperCase ? "0123456789ABCDEF" : "0123456789abcdef";
+        char digits[16];
+        uint8_t count = 0;
+
+        do {
+            digits[count++] = hexDigits[value & 0x0F];
+            value >>= 4;
+        } while (value > 0);
+
+        for (uint8_t i = 0; i < count; ++i)
+            buffer[i] = digits[count - 1 - i];
+
+        buffer[count] = '\0';
+        return count;
+    }
+
+    /**
+     * @brief Writes a floating point value as fixed-point text with the given number of decimals.
+     * @return Number of characters written, buffer must hold at least 24 characters.
+     */
+    static uint8_t formatFixed(char* buffer, double value, uint8_t precision) {
+        if (value != value) {
+            memcpy(buffer, "nan", 4);
+            return 3;
+        }
+
+        uint8_t length = 0;
+
+        if (value < 0) {
+            buffer[length++] = '-';
+            value = -value;
+        }
+
+        if (precision > 9)
+            precision = 9;
+
+        double rounding = 0.5;
+        for (uint8_t i = 0; i < precision; ++i)
+            rounding /= 10.0;
+
+        value += rounding;
+
+        if (value >= 4294967295.0) {
+            memcpy(buffer + length, "ovf", 4);
+            return length + 3;
+        }
+
+        unsigned long integerPart = (unsigned long)value;
+        double remainder = value - (double)integerPart;
+        length += formatUnsigned(buffer + length, integerPart);
+
+        if (precision > 0) {
+            buffer[length++] = '.';
+
+            while (precision-- > 0) {
+                remainder *= 10.0;
+                uint8_t digit = (uint8_t)remainder;
+                buffer[length++] = (char)('0' + digit);
+                remainder -= digit;
+            }
+        }
+
+        buffer[length] = '\0';
+        return length;
     }
 
     /**
-     * @brief Checks if a string ends with a specific character.
+     * @brief Reads one character of a format string held in RAM or program memory.
      */
-    static bool endsWith(const char* str, char c) {
-        if (!str) return false;
-        size_t len = strlen(str);
-        return len > 0 && str[len - 1] == c;
+    static char readFormatChar(const char* format, bool inFlash) {
+        return inFlash ? (char)pgm_read_byte(format) : *format;
     }
 
     /**
@@ -90,9 +187,24 @@
         trimInPlace(param.value);
     }
 
+#if SCM_COMMAND_STATS
+    /**
+     * @brief Counts a time in its log2 histogram bucket, bucket counts stop at 65535.
+     */
+    static void recordTime(uint16_t* histogram, uint32_t elapsed) {
+        uint8_t bucket = 0;
+
+        while (elapsed > 1 && bucket < CommandStatsBuckets - 1) {
+            elapsed >>= 1;
+            bucket++;
+        }
+
+        if (histogram[bucket] < 0xFFFF)
+            histogram[bucket]++;
+    }
+#endif
+
 
-//example to get memory
-// MEM;
 // DEBUG; -- returns the debug mode status
 // DEBUG:ON; -- turns debug mode on
 // DEBUG:OFF; -- turns debug mode off
@@ -131,12 +243,284 @@ public:
 };
 static DebugHandler s_debugHandler;
 
+// LOG; -- sends the contents of the log buffer
+// LOG:CLEAR; -- empties the log buffer
+class LogHandler : public ISerialCommandHandler {
+public:
+    bool handleCommand(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount) override
+    {
+        // Without a log buffer LOG is left to the application's handlers
+        if (sender->getLogBufferSize() == 0)
+            return false;
+
+        if (paramCount >= 1 && strcmp(params[0].key, "CLEAR") == 0)
+            sender->clearLogBuffer();
+        else
+            sender->dumpLogBuffer();
+
+        sender->sendAck(command, F("ok"));
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "LOG" };
+        count = 1;
+        return cmds;
+    }
+};
+static LogHandler s_logHandler;
+
+// CREDIT; -- asks for the receive window to be advertised
+// CREDIT:window=4; -- the peer can accept 4 messages
+// CREDIT:2; -- the peer has read 2 more messages
+class CreditHandler : public ISerialCommandHandler {
+public:
+    bool handleCommand(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount) override
+    {
+        if (sender->_flowControl != FlowControl::Credit)
+            return false;
+
+        if (paramCount == 0)
+        {
+            if (sender->_flowWindow > 0)
+            {
+                sender->_creditsToGrant = 0;
+                sender->sendCredit(sender->_flowWindow, true);
+            }
+        }
+        else if (strcmp(params[0].key, "window") == 0)
+        {
+            if (sender->_creditRequested)
+                sender->_peerCredits = (uint16_t)strtoul(params[0].value, nullptr, 10);
+
+            sender->_creditRequested = false;
+        }
+        else
+        {
+            sender->addCredits(strtoul(params[0].key, nullptr, 10));
+        }
+
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "CREDIT" };
+        count = 1;
+        return cmds;
+    }
+};
+static CreditHandler s_creditHandler;
+
+#if SCM_DIAGNOSTICS
+
+#if defined(__AVR__)
+extern char* __brkval;
+extern char __heap_start;
+#endif
+
+    /**
+     * @brief Gets the free heap in bytes, on AVR the free RAM between the heap and the stack.
+     * @return Free bytes, -1 when the platform does not report it.
+     */
+    static long freeMemory() {
+#if defined(__AVR__)
+        char top;
+        return &top - (__brkval ? __brkval : &__heap_start);
+#elif defined(ESP32) || defined(ESP8266)
+        return (long)ESP.getFreeHeap();
+#else
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Gets the least free stack the current task has had, in bytes.
+     * @return Free bytes, -1 when the platform does not report it.
+     */
+    static long stackHighWater() {
+#if defined(ESP32)
+        return (long)uxTaskGetStackHighWaterMark(nullptr);
+#elif defined(ESP8266)
+        return (long)ESP.getFreeContStack();
+#else
+        return -1;
+#endif
+    }
+
+// MEM; -- free heap, stack high-water and buffer sizes, e.g. MEM:free=1210;rx=128;tx=0;log=0
+// STATS; -- message counts and handler timings, e.g. STATS:rx=12;unk=1;err=0;avg=35;max=120
+// STATS:RESET; -- zeroes the counters
+// STATS:CMD; -- sends the per command counters when built with SCM_COMMAND_STATS
+// PING:t=<host time>; -- echoes t with the device time for round trip measurement, e.g. PING:t=5000;ms=812
+// PERF; -- share of time spent in readCommands() since the last PERF, e.g. PERF:busy=4.5;calls=990;avg=45;ms=1000
+class DiagnosticsHandler : public ISerialCommandHandler {
+public:
+    bool handleCommand(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount) override
+    {
+        if (strcmp(command, "MEM") == 0)
+        {
+            ParamBuilder builder = sender->reply(command);
+            long value = freeMemory();
+
+            if (value >= 0)
+                builder.kv("free", value);
+
+            value = stackHighWater();
+
+            if (value >= 0)
+                builder.kv("stack", value);
+
+            builder.kv("rx", (unsigned int)sender->_maxMessageLength)
+                .kv("tx", (unsigned int)sender->_txBufferSize)
+                .kv("log", (unsigned int)sender->_logSize)
+                .send();
+        }
+        else if (strcmp(command, "STATS") == 0)
+        {
+            if (paramCount >= 1 && strcmp(params[0].key, "RESET") == 0)
+            {
+                sender->_statMessages = 0;
+                sender->_statUnhandled = 0;
+                sender->_statErrors = 0;
+                sender->_statDispatchMicros = 0;
+                sender->_statDispatchMax = 0;
+                sender->sendAck(command, F("ok"));
+                return true;
+            }
+
+#if SCM_COMMAND_STATS
+            if (paramCount >= 1 && strcmp(params[0].key, "CMD") == 0)
+            {
+                sender->sendCommandStats();
+                return true;
+            }
+#endif
+
+            // The STATS message itself is counted but has not finished dispatching
+            uint32_t dispatched = sender->_statMessages > 1 ? sender->_statMessages - 1 : 0;
+
+            sender->reply(command)
+                .kv("rx", (unsigned long)sender->_statMessages)
+                .kv("unk", (unsigned long)sender->_statUnhandled)
+                .kv("err", (unsigned long)sender->_statErrors)
+                .kv("avg", (unsigned long)(dispatched > 0 ? sender->_statDispatchMicros / dispatched : 0))
+                .kv("max", (unsigned long)sender->_statDispatchMax)
+                .send();
+        }
+        else if (strcmp(command, "PING") == 0)
+        {
+            const char* echo = "";
+
+            if (paramCount >= 1)
+                echo = params[0].value[0] != '\0' ? params[0].value : params[0].key;
+
+            sender->reply(command)
+                .kv("t", echo)
+                .kv("ms", (unsigned long)millis())
+                .send();
+        }
+        else
+        {
+            unsigned long now = micros();
+            uint32_t elapsed = (uint32_t)(now - sender->_perfStart);
+
+            sender->reply(command)
+                .kv("busy", elapsed > 0 ? sender->_perfBusyMicros * 100.0 / elapsed : 0.0, 1)
+                .kv("calls", (unsigned long)sender->_perfCalls)
+                .kv("avg", (unsigned long)(sender->_perfCalls > 0 ? sender->_perfBusyMicros / sender->_perfCalls : 0))
+                .kv("ms", (unsigned long)(elapsed / 1000))
+                .send();
+
+            sender->_perfStart = now;
+            sender->_perfBusyMicros = 0;
+            sender->_perfCalls = 0;
+        }
+
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "MEM", "STATS", "PING", "PERF" };
+        count = 4;
+        return cmds;
+    }
+};
+static DiagnosticsHandler s_diagnosticsHandler;
+
+static ISerialCommandHandler* const s_internalHandlers[] = { &s_debugHandler, &s_logHandler, &s_creditHandler, &s_diagnosticsHandler };
+#else
+static ISerialCommandHandler* const s_internalHandlers[] = { &s_debugHandler, &s_logHandler, &s_creditHandler };
+#endif
+static const SerialCommandRegistry s_internalRegistry(s_internalHandlers);
+
 
 // serial command handler;
 
+#if !SCM_NO_HEAP
 SerialCommandManager::SerialCommandManager(Stream* serialPort, MessageReceivedCallback commandReceived, 
     char terminator, char commandSeparator, char paramSeparator, char keyValueSeparator, unsigned long timeoutMilliseconds,
     uint8_t maxCommandLength, uint8_t maxMessageLength)
+{
+    init(serialPort, commandReceived, terminator, commandSeparator, paramSeparator, keyValueSeparator, timeoutMilliseconds);
+    _maxCommandLength = maxCommandLength;
+    _maxMessageLength = maxMessageLength;
+
+    // Allocate buffers
+    _rawMessage = new char[_maxMessageLength + 1];
+    _command = new char[_maxCommandLength + 1];
+    
+    // Initialize buffers to empty strings
+    _rawMessage[0] = '\0';
+    _command[0] = '\0';
+}
+#endif
+
+// Command and message buffers of a manager given too little storage to read, they stay empty
+static char s_noStorage[1] = "";
+
+SerialCommandManager::SerialCommandManager(Stream* serialPort, MessageReceivedCallback commandReceived,
+    uint8_t* storage, size_t storageSize, ISerialCommandHandler** handlerSlots, size_t handlerSlotCount,
+    char terminator, char commandSeparator, char paramSeparator, char keyValueSeparator, unsigned long timeoutMilliseconds,
+    uint8_t maxCommandLength, uint8_t maxMessageLength)
+{
+    init(serialPort, commandReceived, terminator, commandSeparator, paramSeparator, keyValueSeparator, timeoutMilliseconds);
+    _ownsBuffers = false;
+    _handlerSlots = handlerSlots;
+    _handlerSlotCount = handlerSlots ? handlerSlotCount : 0;
+
+    // An empty command and a 1 byte message, each with its terminator, is the least that can be read.
+    // With less the manager only sends, maxMessageLength then just limits outgoing messages
+    if (!storage || storageSize < MinimumStorageSize)
+    {
+        _maxCommandLength = 0;
+        _maxMessageLength = maxMessageLength;
+        _command = s_noStorage;
+        _rawMessage = s_noStorage;
+        return;
+    }
+
+    // Reduce the maximum lengths to fit smaller storage, each buffer keeps room for its terminator
+    if (storageSize < SerialCommandManager::storageSize(maxCommandLength, maxMessageLength))
+    {
+        if (storageSize < (size_t)maxCommandLength + 3)
+            maxCommandLength = storageSize > 3 ? (uint8_t)(storageSize - 3) : 0;
+
+        maxMessageLength = (uint8_t)(storageSize - maxCommandLength - 2);
+    }
+
+    _maxCommandLength = maxCommandLength;
+    _maxMessageLength = maxMessageLength;
+
+    // Carve the buffers from storage
+    _command = reinterpret_cast<char*>(storage);
+    _rawMessage = _command + _maxCommandLength + 1;
+
+    _rawMessage[0] = '\0';
+    _command[0] = '\0';
+}
+
+void SerialCommandManager::init(Stream* serialPort, MessageReceivedCallback commandReceived, char terminator,
+    char commandSeparator, char paramSeparator, char keyValueSeparator, unsigned long timeoutMilliseconds)
 {
     _serialPort = serialPort;
     _messageReceivedCallback = commandReceived;
@@ -145,63 +529,95 @@ SerialCommandManager::SerialCommandManager(Stream* serialPort, MessageReceivedCa
     _paramSeparator = paramSeparator;
     _keyValueSeparator = keyValueSeparator;
     _serialTimeout = timeoutMilliseconds;
-    _maxCommandLength = maxCommandLength;
-    _maxMessageLength = maxMessageLength;
     _isDebug = false;
     _paramCount = 0;
     _messageTimeout = false;
 
-    // Allocate buffers
-    _incomingMessage = new char[_maxMessageLength + 1];
-    _rawMessage = new char[_maxMessageLength + 1];
-    _command = new char[_maxCommandLength + 1];
-    
-    // Initialize buffers to empty strings
-    _incomingMessage[0] = '\0';
-    _rawMessage[0] = '\0';
-    _command[0] = '\0';
-    
+    for (uint8_t i = 0; i < LogModuleCount; ++i)
+        _logLevels[i] = SCM_LOG_LEVEL;
+
     // Initialize parameter buffers
     for ( uint8_t i = 0; i < MaximumParameterCount; ++i )
     {
         _params[i].key[0] = '\0';
         _params[i].value[0] = '\0';
     }
-    
-    // add handlers
-    registerHandlers(nullptr, 0);
 }
 
 SerialCommandManager::~SerialCommandManager()
 {
-    delete[] _handlerObjects;
+    releaseRegistry();
     
+#if !SCM_NO_HEAP
     // Clean up dynamically allocated buffers
-    delete[] _incomingMessage;
-    delete[] _rawMessage;
-    delete[] _command;
+    if (_ownsBuffers)
+    {
+        delete[] _rawMessage;
+        delete[] _command;
+    }
+
+    if (_ownsTxBuffer)
+        delete[] _txBuffer;
+
+    if (_ownsLogRecords)
+        delete[] _logRecords;
+#endif
 }
 
 void SerialCommandManager::registerHandlers(ISerialCommandHandler** handlers, size_t handlerCount)
 {
-    if (_handlerObjects)
-    {
-        delete[] _handlerObjects;
-        _handlerObjects = nullptr;
-        _handlerCount = 0;
-	}
+    releaseRegistry();
+
+    if (!handlers || handlerCount == 0)
+        return;
 
-    size_t internalHandlers = 1;
-    _handlerCount = handlerCount + internalHandlers;
-    _handlerObjects = new ISerialCommandHandler * [_handlerCount];
+    // Copy the array, callers commonly pass a local array from setup()
+    ISerialCommandHandler** handlerObjects = _handlerSlots;
 
-    // internal debug handler
-    _handlerObjects[0] = &s_debugHandler;
+    if (handlerObjects)
+    {
+        if (handlerCount > _handlerSlotCount)
+            handlerCount = _handlerSlotCount;
+    }
+    else
+    {
+#if SCM_NO_HEAP
+        return;
+#else
+        handlerObjects = new ISerialCommandHandler * [handlerCount];
+#endif
+    }
 
-    for (size_t i = 1; i < _handlerCount; i++)
+    for (size_t i = 0; i < handlerCount; i++)
     {
-        _handlerObjects[i] = handlers[i - internalHandlers];
+        handlerObjects[i] = handlers[i];
     }
+
+    _ownedRegistry = SerialCommandRegistry(handlerObjects, handlerCount);
+    _registry = &_ownedRegistry;
+}
+
+void SerialCommandManager::setRegistry(const SerialCommandRegistry* registry)
+{
+    releaseRegistry();
+    _registry = registry;
+}
+
+const SerialCommandRegistry* SerialCommandManager::getRegistry()
+{
+    return _registry;
+}
+
+void SerialCommandManager::releaseRegistry()
+{
+#if !SCM_NO_HEAP
+    // The handler array was allocated by registerHandlers() unless the caller provided slots
+    if (_registry == &_ownedRegistry && !_handlerSlots)
+        delete[] _ownedRegistry.getHandlers();
+#endif
+
+    _ownedRegistry = SerialCommandRegistry(nullptr, 0);
+    _registry = nullptr;
 }
 
 bool SerialCommandManager::isTimeout()
@@ -209,6 +625,11 @@ bool SerialCommandManager::isTimeout()
     return _messageTimeout;
 }
 
+bool SerialCommandManager::isReceiving() const
+{
+    return _readingMessage;
+}
+
 const char* SerialCommandManager::getCommand()
 {
     return _command;
@@ -227,79 +648,585 @@ uint8_t SerialCommandManager::getArgCount()
     return _paramCount;
 }
 
-const char* SerialCommandManager::getRawMessage()
+#if SCM_CONCURRENT
+// Id of the deferred command the calling task is running, see setTaskCorrelationId()
+static thread_local const char* t_taskCorrelationId = nullptr;
+
+void SerialCommandManager::setTaskCorrelationId(const char* correlationId)
 {
-    return _rawMessage;
+    t_taskCorrelationId = correlationId;
 }
+#endif
 
-void SerialCommandManager::readCommands()
+const char* SerialCommandManager::replyCorrelationId() const
 {
-    // Check if any characters have arrived
-    while (_serialPort->available() > 0)
+#if SCM_CONCURRENT
+    if (t_taskCorrelationId)
+        return t_taskCorrelationId;
+#endif
+
+    return _correlationId;
+}
+
+const char* SerialCommandManager::getCorrelationId()
+{
+    return replyCorrelationId();
+}
+
+void SerialCommandManager::extractCorrelationId()
+{
+    _correlationId[0] = '\0';
+
+    for (uint8_t i = 0; i < _paramCount; ++i)
     {
-        char inChar = (char)_serialPort->read();
+        trimParameter(_params[i]);
 
-        _lastCharTime = millis();
+        if (strcmp(_params[i].key, SCM_CORRELATION_KEY) != 0)
+            continue;
 
-        if (!_readingMessage)
-        {
-            _readingMessage = true;
-            _messageTimeout = false;
-            _isParsingCommand = true;
-            _isParsingParamName = true;
-            _rawMessage[0] = '\0';           // Clear raw message
-            _incomingMessage[0] = '\0';      // Clear incoming message
-            _paramCount = 0;
-        }
+        safeCopy(_correlationId, _params[i].value, CorrelationIdLength);
 
-        // Append character to raw message
-        size_t rawLen = strlen(_rawMessage);
-        if (!appendChar(_rawMessage, inChar, rawLen, _maxMessageLength))
-        {
-            sendError("Raw buffer full", "SerialCommandManager");
-            _readingMessage = false;
-            return;
-        }
+        // Handlers only see their own parameters
+        for (uint8_t j = i + 1; j < _paramCount; ++j)
+            _params[j - 1] = _params[j];
 
-        if (inChar == _terminator)
-        {
-            _readingMessage = false;
+        _paramCount--;
+        return;
+    }
+}
 
-            // Strip terminator and any trailing newline/CR
-            trimInPlace(_incomingMessage);
-            if (endsWith(_incomingMessage, _terminator))
-            {
-                size_t len = strlen(_incomingMessage);
-                if (len > 0) {
-                    _incomingMessage[len - 1] = '\0';
-                }
-            }
-            
-            // Find command separator
-            int16_t sepChar = findChar(_incomingMessage, _commandSeparator);
-            
-            if (sepChar > -1)
-            {
-                // Extract command (substring before separator)
-                strncpy(_command, _incomingMessage, sepChar);
-                _command[sepChar] = '\0';
-            }
-            else
-            {
-                // No separator, entire message is the command
-                safeCopy(_command, _incomingMessage, _maxCommandLength);
-            }
-            
-            trimInPlace(_command);
+bool SerialCommandManager::writeCorrelationId(const char* correlationId)
+{
+    if (!correlationId || correlationId[0] == '\0')
+        return false;
 
-            if (!processMessage() && _messageReceivedCallback)
-                _messageReceivedCallback(this);
+    writeBytes(SCM_CORRELATION_KEY, sizeof(SCM_CORRELATION_KEY) - 1);
+    writeChar(_keyValueSeparator);
+    writeText(correlationId);
+    return true;
+}
 
-            break;
-        }
-        else if (inChar == _commandSeparator)
-        {
-            if (_isParsingCommand)
+const char* SerialCommandManager::getRawMessage()
+{
+    return _rawMessage;
+}
+
+void SerialCommandManager::readCommands()
+{
+    readCommands(0);
+}
+
+void SerialCommandManager::readCommands(uint16_t maxBytes)
+{
+#if SCM_DIAGNOSTICS
+    unsigned long start = micros();
+#endif
+
+    readIncoming(maxBytes);
+    poll();
+
+#if SCM_DIAGNOSTICS
+    _perfBusyMicros += (uint32_t)(micros() - start);
+    _perfCalls++;
+#endif
+}
+
+void SerialCommandManager::poll()
+{
+    sendSuppressedSummary();
+    updateFlowControl();
+
+    if (!_txBuffer)
+        return;
+
+    // While batching, hold queued messages until the buffer fills or the deadline expires
+    if (_batchDeadline == 0 || _batchFlush || _txCount >= _txBufferSize - (_txBufferSize / 4) ||
+        millis() - _batchStart >= _batchDeadline)
+    {
+        flushBatch();
+    }
+
+    // Report dropped messages once there is room for the report itself
+    if (_txOverflowPolicy == TxOverflowPolicy::Report && _txDroppedUnreported > 0 && 
+        _txBufferSize - _txCount >= TxOverflowReportLength && beginMessage(false, true))
+    {
+        char number[11];
+        uint16_t dropped = _txDroppedUnreported;
+        _txDroppedUnreported = 0;
+
+        writeBytes("ERR", 3);
+        writeChar(_commandSeparator);
+
+        if (getCompactErrors())
+            writeBytes(number, formatUnsigned(number, (uint8_t)ErrorCode::TxOverflow));
+        else
+            writeBytes("TX overflow", 11);
+
+        writeChar(_commandSeparator);
+        writeBytes("dropped", 7);
+        writeChar(_keyValueSeparator);
+        writeBytes(number, formatUnsigned(number, dropped));
+        writeChar(_terminator);
+        endMessage();
+
+        flushBatch();
+    }
+}
+
+void SerialCommandManager::updateFlowControl()
+{
+    if (_flowWindow == 0)
+        return;
+
+    if (_flowControl == FlowControl::Credit)
+    {
+        // Coalesce grants while more input is waiting, grant straight away once idle
+        if (_creditsToGrant > 0 && (_creditsToGrant >= (_flowWindow + 1) / 2 || _serialPort->available() == 0) &&
+            sendCredit(_creditsToGrant, false))
+        {
+            _creditsToGrant = 0;
+        }
+    }
+    else if (_flowControl == FlowControl::XonXoff)
+    {
+        int waiting = _serialPort->available();
+
+        checkXoff(waiting);
+
+        // XON/XOFF bypass the transmit buffer
+        if (_xoffSent && waiting <= _flowWindow / 4)
+        {
+            _serialPort->write(FlowXon);
+            _xoffSent = false;
+        }
+    }
+}
+
+void SerialCommandManager::checkXoff(int waiting)
+{
+    // Bypasses the transmit buffer, the peer must react before the receive buffer fills
+    if (!_xoffSent && _flowWindow > 0 && waiting >= _flowWindow - (_flowWindow / 4))
+    {
+        _serialPort->write(FlowXoff);
+        _xoffSent = true;
+    }
+}
+
+bool SerialCommandManager::sendCredit(uint16_t credits, bool advertise)
+{
+    if (!beginMessage(false, true))
+        return false;
+
+    writeBytes("CREDIT", 6);
+
+    if (credits > 0 || advertise)
+    {
+        char number[6];
+        writeChar(_commandSeparator);
+
+        if (advertise)
+        {
+            writeBytes("window", 6);
+            writeChar(_keyValueSeparator);
+        }
+
+        writeBytes(number, formatUnsigned(number, credits));
+    }
+
+    writeChar(_terminator);
+
+    // Control frames are outside the accounting, or two idle peers would grant each other forever
+    bool sent = !_txFrameDropped;
+    endMessage(false);
+    return sent;
+}
+
+void SerialCommandManager::setFlowControl(FlowControl mode, uint16_t window)
+{
+    _flowControl = mode;
+    _flowWindow = mode == FlowControl::None ? 0 : window;
+    _creditsToGrant = 0;
+    _peerCredits = 0;
+    _xoffSent = false;
+    _peerPaused = false;
+    _creditRequested = false;
+
+    // Advertise the receive window, or ask the peer for theirs
+    if (mode == FlowControl::Credit)
+        _creditRequested = sendCredit(_flowWindow, _flowWindow > 0) && _flowWindow == 0;
+}
+
+FlowControl SerialCommandManager::getFlowControl()
+{
+    return _flowControl;
+}
+
+bool SerialCommandManager::canSend()
+{
+    if (_flowControl == FlowControl::Credit)
+        return _peerCredits > 0;
+
+    if (_flowControl == FlowControl::XonXoff)
+        return !_peerPaused;
+
+    return true;
+}
+
+uint16_t SerialCommandManager::getCredits()
+{
+    return _peerCredits;
+}
+
+void SerialCommandManager::spendCredit()
+{
+#if SCM_CONCURRENT
+    // Senders on several tasks may spend at once, never take the count below zero
+    uint16_t credits = _peerCredits.load();
+
+    while (credits > 0 && !_peerCredits.compare_exchange_weak(credits, (uint16_t)(credits - 1)))
+    {
+    }
+#else
+    if (_peerCredits > 0)
+        _peerCredits--;
+#endif
+}
+
+void SerialCommandManager::addCredits(unsigned long credits)
+{
+#if SCM_CONCURRENT
+    uint16_t current = _peerCredits.load();
+    uint16_t updated;
+
+    do
+    {
+        unsigned long total = current + credits;
+        updated = total > 0xFFFF ? 0xFFFF : (uint16_t)total;
+    }
+    while (!_peerCredits.compare_exchange_weak(current, updated));
+#else
+    unsigned long total = _peerCredits + credits;
+    _peerCredits = total > 0xFFFF ? 0xFFFF : (uint16_t)total;
+#endif
+}
+
+#if SCM_COMMAND_STATS
+void SerialCommandManager::recordCommand(uint32_t elapsed, bool handled)
+{
+    static const char unlisted[] = "*";
+
+    // Key the counters by the handler's copy of the command, it outlives the message buffer
+    const char* command = s_internalRegistry.findCommand(_command);
+
+    if (!command && _registry)
+        command = _registry->findCommand(_command);
+
+    if (!command)
+        command = unlisted;
+
+    CommandStats* stats = const_cast<CommandStats*>(getCommandStats(command));
+
+    if (!stats)
+    {
+        // Commands first received once the table is full are not counted
+        if (_commandStatsCount >= SCM_COMMAND_STATS)
+            return;
+
+        stats = &_commandStats[_commandStatsCount++];
+        memset(stats, 0, sizeof(CommandStats));
+        stats->command = command;
+    }
+
+    stats->received++;
+
+    if (handled)
+    {
+        stats->handled++;
+    }
+    else
+    {
+        if (command != unlisted)
+            stats->failed++;
+
+        if (_messageReceivedCallback)
+            stats->fellThrough++;
+    }
+
+    recordTime(stats->histogram, elapsed);
+}
+
+const CommandStats* SerialCommandManager::getCommandStats(const char* command)
+{
+    if (!command)
+        return nullptr;
+
+    for (uint8_t i = 0; i < _commandStatsCount; i++)
+    {
+        if (strcmp(_commandStats[i].command, command) == 0)
+            return &_commandStats[i];
+    }
+
+    return nullptr;
+}
+
+const CommandStats* SerialCommandManager::getCommandStatsAt(uint8_t index)
+{
+    return index < _commandStatsCount ? &_commandStats[index] : nullptr;
+}
+
+uint8_t SerialCommandManager::getCommandStatsCount()
+{
+    return _commandStatsCount;
+}
+
+const uint16_t* SerialCommandManager::getParseHistogram()
+{
+    return _parseHistogram;
+}
+
+void SerialCommandManager::resetCommandStats()
+{
+    _commandStatsCount = 0;
+    memset(_parseHistogram, 0, sizeof(_parseHistogram));
+}
+
+uint8_t SerialCommandManager::formatHistogram(char* buffer, const uint16_t* histogram)
+{
+    uint8_t used = CommandStatsBuckets;
+
+    while (used > 1 && histogram[used - 1] == 0)
+        used--;
+
+    uint8_t length = 0;
+
+    for (uint8_t i = 0; i < used; i++)
+    {
+        if (i > 0)
+            buffer[length++] = ',';
+
+        length += formatUnsigned(buffer + length, histogram[i]);
+    }
+
+    return length;
+}
+
+void SerialCommandManager::sendCommandStats()
+{
+    char buckets[CommandStatsBuckets * 6];
+
+    for (uint8_t i = 0; i < _commandStatsCount; i++)
+    {
+        const CommandStats& stats = _commandStats[i];
+        formatHistogram(buckets, stats.histogram);
+
+        reply(F("STAT"))
+            .kv(stats.command, (unsigned long)stats.received)
+            .kv("ok", (unsigned long)stats.handled)
+            .kv("fail", (unsigned long)stats.failed)
+            .kv("cb", (unsigned long)stats.fellThrough)
+            .kv("us", static_cast<const char*>(buckets))
+            .send();
+    }
+
+    unsigned long parsed = 0;
+
+    for (uint8_t i = 0; i < CommandStatsBuckets; i++)
+        parsed += _parseHistogram[i];
+
+    formatHistogram(buckets, _parseHistogram);
+
+    reply(F("STAT"))
+        .kv("parse", parsed)
+        .kv("us", static_cast<const char*>(buckets))
+        .send();
+}
+#endif
+
+void SerialCommandManager::flush()
+{
+    if (_txBuffer)
+        flushBatch();
+}
+
+void SerialCommandManager::flushBatch()
+{
+    drainTx(false);
+
+    // Keep sending on later polls until everything queued so far has gone
+    _batchFlush = _txCount > 0;
+}
+
+bool SerialCommandManager::setBatching(uint16_t deadlineMilliseconds)
+{
+    if (deadlineMilliseconds > 0 && !_txBuffer)
+        return false;
+
+    if (deadlineMilliseconds == 0 && _txBuffer)
+        flushBatch();
+
+    _batchDeadline = deadlineMilliseconds;
+    _batchStart = millis();
+    return true;
+}
+
+#if !SCM_NO_HEAP
+bool SerialCommandManager::setTxBuffer(uint16_t size, TxOverflowPolicy policy)
+{
+    if (size == 0)
+        return setTxBuffer(nullptr, 0, policy);
+
+    if (policy == TxOverflowPolicy::Report && size < TxOverflowReportLength)
+        return false;
+
+    char* buffer = new char[size];
+
+    if (!buffer)
+    {
+        setTxBuffer(nullptr, 0, policy);
+        return false;
+    }
+
+    setTxBuffer(buffer, size, policy);
+    _ownsTxBuffer = true;
+    return true;
+}
+#endif
+
+bool SerialCommandManager::setTxBuffer(char* buffer, uint16_t size, TxOverflowPolicy policy)
+{
+    // A smaller buffer could never hold the overflow report
+    if (buffer && size > 0 && policy == TxOverflowPolicy::Report && size < TxOverflowReportLength)
+        return false;
+
+    if (_txBuffer)
+    {
+        drainTx(true);
+
+#if !SCM_NO_HEAP
+        if (_ownsTxBuffer)
+            delete[] _txBuffer;
+#endif
+
+        _txBuffer = nullptr;
+    }
+
+    _ownsTxBuffer = false;
+    _txBufferSize = 0;
+    _txHead = 0;
+    _txTail = 0;
+    _txCount = 0;
+    _txOverflowPolicy = policy;
+
+    if (!buffer || size == 0)
+    {
+        _batchDeadline = 0;
+        return true;
+    }
+
+    _txBuffer = buffer;
+    _txBufferSize = size;
+    return true;
+}
+
+uint16_t SerialCommandManager::getTxPending()
+{
+    return _txCount;
+}
+
+uint16_t SerialCommandManager::getTxDropped()
+{
+    return _txDropped;
+}
+
+void SerialCommandManager::readIncoming(uint16_t maxBytes)
+{
+    uint16_t bytesRead = 0;
+    int waiting;
+
+    // Constructed without enough storage to hold a message
+    if (_rawMessage == s_noStorage)
+        return;
+
+    // Check if any characters have arrived
+    while ((maxBytes == 0 || bytesRead++ < maxBytes) && (waiting = _serialPort->available()) > 0)
+    {
+        // The buffer is fullest before it is read, so XOFF is decided here rather than after draining
+        if (_flowControl == FlowControl::XonXoff)
+            checkXoff(waiting);
+
+        char inChar = (char)_serialPort->read();
+
+        // XON/XOFF may arrive anywhere, even inside a message
+        if (_flowControl == FlowControl::XonXoff && ((uint8_t)inChar == FlowXon || (uint8_t)inChar == FlowXoff))
+        {
+            _peerPaused = (uint8_t)inChar == FlowXoff;
+            continue;
+        }
+
+        _lastCharTime = millis();
+
+        if (!_readingMessage)
+        {
+            _readingMessage = true;
+            _messageTimeout = false;
+            _isParsingCommand = true;
+            _isParsingParamName = true;
+            _rawMessage[0] = '\0';           // Clear raw message
+            _rawLength = 0;
+            _command[0] = '\0';              // Clear command
+            _commandLength = 0;
+            _paramCount = 0;
+
+#if SCM_COMMAND_STATS
+            _parseStart = micros();
+#endif
+
+            SCM_TRACE(this, TraceEvent::FirstByte);
+        }
+
+        // Append character to raw message, the only copy of the whole message
+        if (!appendChar(_rawMessage, inChar, _rawLength, _maxMessageLength))
+        {
+            sendLibraryError(ErrorCode::RawBufferFull);
+            _readingMessage = false;
+            return;
+        }
+
+        _rawLength++;
+
+        if (inChar == _terminator)
+        {
+            _readingMessage = false;
+
+            SCM_TRACE(this, TraceEvent::Terminator);
+
+#if SCM_COMMAND_STATS
+            recordTime(_parseHistogram, (uint32_t)(micros() - _parseStart));
+#endif
+
+            trimInPlace(_command);
+
+            extractCorrelationId();
+
+            SCM_TRACE(this, TraceEvent::CommandResolved);
+
+            // The message has left the receive buffer, its slot can be granted back. CREDIT frames
+            // were not paid for by the peer, so they earn nothing
+            if (_flowControl == FlowControl::Credit && _flowWindow > 0 && _creditsToGrant < _flowWindow &&
+                strcmp(_command, "CREDIT") != 0)
+                _creditsToGrant++;
+
+            if (!processMessage() && _messageReceivedCallback)
+                _messageReceivedCallback(this);
+
+            // Replies sent after the message has been handled are not correlated with it
+            _correlationId[0] = '\0';
+
+            break;
+        }
+        else if (inChar == _commandSeparator)
+        {
+            if (_isParsingCommand)
             {
                 // First separator after command - transition to parameter parsing
                 _isParsingCommand = false;
@@ -326,6 +1253,8 @@ void SerialCommandManager::readCommands()
                 }
                 _isParsingParamName = true;
             }
+
+            startField();
         }
         else if (inChar == _paramSeparator)  // Add semicolon as parameter separator
         {
@@ -344,71 +1273,153 @@ void SerialCommandManager::readCommands()
                 }
                 _isParsingParamName = true;
             }
+
+            startField();
         }
         else if (inChar == _keyValueSeparator)
         {
             _isParsingParamName = false;
+            startField();
         }
         else
         {
             if (_isParsingCommand)
             {
-                size_t msgLen = strlen(_incomingMessage);
-                if (!appendChar(_incomingMessage, inChar, msgLen, _maxMessageLength))
-                {
-                    sendError("Message buffer full", "SerialCommandManager");
-                    _readingMessage = false;
-                    return;
-                }
+                // Command characters beyond the command buffer are dropped
+                if (appendChar(_command, inChar, _commandLength, _maxCommandLength))
+                    _commandLength++;
             }
             else if (_paramCount > 0 && _paramCount <= MaximumParameterCount)
             {
                 if (_isParsingParamName)
                 {
-                    size_t keyLen = strlen(_params[_paramCount - 1].key);
-                    if (!appendChar(_params[_paramCount - 1].key, inChar, keyLen, DefaultMaxParamKeyLength))
+                    if (!appendChar(_params[_paramCount - 1].key, inChar, _fieldLength, DefaultMaxParamKeyLength))
                     {
-                        sendError("Param key too long", "SerialCommandManager");
+                        sendLibraryError(ErrorCode::ParamKeyTooLong);
                         _readingMessage = false;
                         return;
                     }
                 }
                 else
                 {
-                    size_t valLen = strlen(_params[_paramCount - 1].value);
-                    if (!appendChar(_params[_paramCount - 1].value, inChar, valLen, DefaultMaxParamValueLength))
+                    if (!appendChar(_params[_paramCount - 1].value, inChar, _fieldLength, DefaultMaxParamValueLength))
                     {
-                        sendError(F("Param value too long"), F("SerialCommandManager"));
+                        sendLibraryError(ErrorCode::ParamValueTooLong);
                         _readingMessage = false;
                         return;
                     }
                 }
-            }
-        }
 
-        // Check message length
-        if (strlen(_incomingMessage) > _maxMessageLength)
-        {
-            sendError("Too Long", "SerialCommandManager");
-            _readingMessage = false;
-            return;
+                _fieldLength++;
+            }
         }
     }
 
     if (_readingMessage && (millis() - _lastCharTime > _serialTimeout))
     {
-        sendError("Timeout", "SerialCommandManager");
+        sendLibraryError(ErrorCode::Timeout);
         _messageTimeout = true;
         _readingMessage = false;
         return;
     }
 }
 
-void SerialCommandManager::sendCommand(const char* header, const char* message, const char* identifier, const StringKeyValue* params, uint8_t argLength)
+void SerialCommandManager::startField()
 {
-    if (!header || header[0] == '\0')
-        return;
+    // Separators are rare, measure the field once rather than on every character appended
+    if (_paramCount == 0)
+        _fieldLength = 0;
+    else if (_isParsingParamName)
+        _fieldLength = (uint8_t)strlen(_params[_paramCount - 1].key);
+    else
+        _fieldLength = (uint8_t)strlen(_params[_paramCount - 1].value);
+}
+
+void SerialCommandManager::sendCommand(const char* header, const char* message, const char* identifier, const StringKeyValue* params, uint8_t argLength)
+{
+    if (!header || header[0] == '\0')
+        return;
+
+    writeCommand(header, false, message, identifier, params, argLength);
+}
+
+void SerialCommandManager::sendCommand(const __FlashStringHelper* header, const char* message, const char* identifier, const StringKeyValue* params, uint8_t argLength)
+{
+    if (!header || pgm_read_byte(reinterpret_cast<const char*>(header)) == '\0')
+        return;
+
+    writeCommand(reinterpret_cast<const char*>(header), true, message, identifier, params, argLength);
+}
+
+void SerialCommandManager::sendAck(const char* command, const char* result, const StringKeyValue* params, uint8_t argLength)
+{
+    writeAck(replyCorrelationId(), command, result, nullptr, params, argLength);
+}
+
+void SerialCommandManager::sendAck(const char* command, const __FlashStringHelper* result, const StringKeyValue* params, uint8_t argLength)
+{
+    writeAck(replyCorrelationId(), command, nullptr, result, params, argLength);
+}
+
+void SerialCommandManager::sendCorrelatedAck(const char* correlationId, const char* command, const char* result, const StringKeyValue* params, uint8_t argLength)
+{
+    writeAck(correlationId, command, result, nullptr, params, argLength);
+}
+
+ParamBuilder SerialCommandManager::reply(const char* header, const char* message)
+{
+    if (!header || header[0] == '\0' || !beginMessage(false))
+        return ParamBuilder(nullptr);
+
+    writeText(header);
+
+    if (message && message[0] != '\0')
+    {
+        writeChar(_commandSeparator);
+        writeBytes(message, trimmedLength(message, _maxMessageLength));
+    }
+
+    return ParamBuilder(this);
+}
+
+ParamBuilder SerialCommandManager::reply(const __FlashStringHelper* header, const char* message)
+{
+    if (!header || pgm_read_byte(reinterpret_cast<const char*>(header)) == '\0' || !beginMessage(false))
+        return ParamBuilder(nullptr);
+
+    writeFlash(header);
+
+    if (message && message[0] != '\0')
+    {
+        writeChar(_commandSeparator);
+        writeBytes(message, trimmedLength(message, _maxMessageLength));
+    }
+
+    return ParamBuilder(this);
+}
+
+ParamBuilder SerialCommandManager::replyAck(const char* command, const __FlashStringHelper* result)
+{
+    if (!command || !beginMessage(false, true))
+        return ParamBuilder(nullptr);
+
+    writeBytes("ACK", 3);
+    writeChar(_commandSeparator);
+    writeText(command);
+    writeChar(_keyValueSeparator);
+    writeFlash(result);
+
+    ParamBuilder builder(this);
+    const char* correlationId = replyCorrelationId();
+
+    if (correlationId[0] != '\0')
+        builder.kv(SCM_CORRELATION_KEY, correlationId);
 
+    return builder;
+}
+
+void SerialCommandManager::writeCommand(const char* header, bool headerInFlash, const char* message, const char* identifier, const StringKeyValue* params, uint8_t argLength)
+{
     // Normalize argLength and guard params pointer
     if (argLength > MaximumParameterCount)
         argLength = MaximumParameterCount;
@@ -416,72 +1427,468 @@ void SerialCommandManager::sendCommand(const char* header, const char* message,
     if (argLength > 0 && params == nullptr)
         argLength = 0;
 
-    // Make a local copy of message to sanitize terminator/CRLF if necessary
-    char msg[_maxMessageLength + 1];
-    if (message)
-    {
-        safeCopy(msg, message, _maxMessageLength);
-        removeTrailingTerminators(msg);
-    }
-    else
-    {
-        msg[0] = '\0';
-    }
+    // Sanitize trailing terminator/CRLF by length rather than copying the message
+    size_t msgLen = message ? trimmedLength(message, _maxMessageLength) : 0;
 
-    _serialPort->print(header);
+    if (!beginMessage(false))
+        return;
+
+    if (headerInFlash)
+        writeFlash(reinterpret_cast<const __FlashStringHelper*>(header));
+    else
+        writeText(header);
     
     // Only print separator if we have message content or parameters
-    if (msg[0] != '\0' || argLength > 0)
+    if (msgLen > 0 || argLength > 0)
     {
-        _serialPort->print(_commandSeparator);
+        writeChar(_commandSeparator);
     }
 
-    if (msg[0] != '\0')
+    if (msgLen > 0)
     {
-        _serialPort->print(msg);
+        writeBytes(message, msgLen);
 
         if (argLength > 0)
-            _serialPort->print(_commandSeparator);
+            writeChar(_commandSeparator);
     }
 
-    for (uint8_t i = 0; i < argLength; ++i)
+    writeParams(params, argLength);
+    writeIdentifier(identifier, nullptr);
+
+    // Only print the terminator if message doesn't already end with it
+    if (msgLen == 0 || message[msgLen - 1] != _terminator)
+        writeChar(_terminator);
+
+    endMessage();
+}
+
+void SerialCommandManager::writeAck(const char* correlationId, const char* command, const char* result, const __FlashStringHelper* flashResult, const StringKeyValue* params, uint8_t argLength)
+{
+    if (!command)
+        return;
+
+    if (argLength > MaximumParameterCount)
+        argLength = MaximumParameterCount;
+
+    if (argLength > 0 && params == nullptr)
+        argLength = 0;
+
+    if (!beginMessage(false, true))
+        return;
+
+    // ACK:<command>=<result>[:<params>]
+    writeBytes("ACK", 3);
+    writeChar(_commandSeparator);
+    writeText(command);
+    writeChar(_keyValueSeparator);
+
+    if (flashResult)
+        writeFlash(flashResult);
+    else
+        writeText(result);
+
+    bool hasId = correlationId && correlationId[0] != '\0';
+
+    if (hasId || argLength > 0)
     {
-        if (!params)
-            break;
+        writeChar(_commandSeparator);
+
+        if (writeCorrelationId(correlationId) && argLength > 0)
+            writeChar(_paramSeparator);
+
+        writeParams(params, argLength);
+    }
 
-        _serialPort->print(params[i].key);
-        _serialPort->print(_keyValueSeparator);
-        _serialPort->print(params[i].value);
+    writeChar(_terminator);
+    endMessage();
+}
+
+void SerialCommandManager::writeParams(const StringKeyValue* params, uint8_t argLength)
+{
+    for (uint8_t i = 0; i < argLength; ++i)
+    {
+        writeText(params[i].key);
+        writeChar(_keyValueSeparator);
+        writeText(params[i].value);
 
         if (i != argLength - 1)
-            _serialPort->print(_paramSeparator);
+            writeChar(_paramSeparator);
     }
+}
+
+void SerialCommandManager::sendCommandf(const char* header, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    sendFormatted(header, format, false, LogLevel::None, args);
+    va_end(args);
+}
+
+void SerialCommandManager::sendCommandf(const char* header, const __FlashStringHelper* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    sendFormatted(header, reinterpret_cast<const char*>(format), true, LogLevel::None, args);
+    va_end(args);
+}
+
+void SerialCommandManager::sendDebugf(const char* format, ...)
+{
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_DEBUG
+    if (!isLogEnabled(LogLevel::Debug) || captureLog(LogLevel::Debug, format, false, nullptr) || 
+        !allowMessage(LogLevel::Debug, format, false))
+        return;
+
+    va_list args;
+    va_start(args, format);
+    sendFormatted("DEBUG", format, false, LogLevel::Debug, args);
+    va_end(args);
+#else
+    (void)format;
+#endif
+}
+
+void SerialCommandManager::sendDebugf(const __FlashStringHelper* format, ...)
+{
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_DEBUG
+    const char* flashFormat = reinterpret_cast<const char*>(format);
+
+    if (!isLogEnabled(LogLevel::Debug) || captureLog(LogLevel::Debug, flashFormat, true, nullptr) || 
+        !allowMessage(LogLevel::Debug, flashFormat, true))
+        return;
+
+    va_list args;
+    va_start(args, format);
+    sendFormatted("DEBUG", reinterpret_cast<const char*>(format), true, LogLevel::Debug, args);
+    va_end(args);
+#else
+    (void)format;
+#endif
+}
+
+void SerialCommandManager::sendErrorf(const char* format, ...)
+{
+    if (!isLogEnabled(LogLevel::Error) || !allowMessage(LogLevel::Error, format, false))
+        return;
+
+    va_list args;
+    va_start(args, format);
+    sendFormatted("ERR", format, false, LogLevel::Error, args);
+    va_end(args);
+}
+
+void SerialCommandManager::sendErrorf(const __FlashStringHelper* format, ...)
+{
+    if (!isLogEnabled(LogLevel::Error) || !allowMessage(LogLevel::Error, reinterpret_cast<const char*>(format), true))
+        return;
+
+    va_list args;
+    va_start(args, format);
+    sendFormatted("ERR", reinterpret_cast<const char*>(format), true, LogLevel::Error, args);
+    va_end(args);
+}
+
+void SerialCommandManager::sendFormatted(const char* header, const char* format, bool formatInFlash, LogLevel level, va_list args)
+{
+    if (!header || header[0] == '\0' || !format)
+        return;
+
+    if (!beginMessage(level >= LogLevel::Debug, level == LogLevel::Error))
+        return;
+
+    writeText(header);
+
+    char last = '\0';
 
-    if (identifier && identifier[0] != '\0')
+    if (readFormatChar(format, formatInFlash) != '\0')
     {
-        _serialPort->print(": (");
-        _serialPort->print(identifier);
-        _serialPort->print(")");
+        writeChar(_commandSeparator);
+        last = writeFormatted(format, formatInFlash, args);
     }
 
-    // Only print the terminator if message doesn't already end with it
-    if (!endsWith(msg, _terminator))
-        _serialPort->print(_terminator);
+    if (last != _terminator)
+        writeChar(_terminator);
+
+    endMessage();
 }
 
+char SerialCommandManager::writeFormatted(const char* format, bool formatInFlash, va_list args)
+{
+    char buffer[24];
+    char last = '\0';
+
+    while (true)
+    {
+        char c = readFormatChar(format++, formatInFlash);
+
+        if (c == '\0')
+            break;
+
+        if (c != '%')
+        {
+            writeChar(c);
+            last = c;
+            continue;
+        }
+
+        // %[flags][width][.precision][h|l|ll]specifier, of the flags only '-' and '0' change the output
+        bool zeroPad = false;
+        bool leftAlign = false;
+        uint8_t width = 0;
+        int8_t precision = -1;
+        bool isLong = false;
+        bool isLongLong = false;
+
+        c = readFormatChar(format++, formatInFlash);
+
+        while (c == '-' || c == '0' || c == '+' || c == ' ' || c == '#')
+        {
+            if (c == '-')
+                leftAlign = true;
+            else if (c == '0')
+                zeroPad = true;
+
+            c = readFormatChar(format++, formatInFlash);
+        }
+
+        while (c >= '0' && c <= '9')
+        {
+            width = (uint8_t)(width * 10 + (c - '0'));
+            c = readFormatChar(format++, formatInFlash);
+        }
+
+        if (c == '.')
+        {
+            precision = 0;
+            c = readFormatChar(format++, formatInFlash);
+
+            while (c >= '0' && c <= '9')
+            {
+                precision = (int8_t)(precision * 10 + (c - '0'));
+                c = readFormatChar(format++, formatInFlash);
+            }
+        }
+
+        // h and hh arguments are promoted to int, ll is accepted and formatted as long
+        while (c == 'h')
+            c = readFormatChar(format++, formatInFlash);
+
+        if (c == 'l')
+        {
+            isLong = true;
+            c = readFormatChar(format++, formatInFlash);
+
+            if (c == 'l')
+            {
+                isLongLong = true;
+                c = readFormatChar(format++, formatInFlash);
+            }
+        }
+
+        const char* text = buffer;
+        size_t length = 0;
+        bool isNumeric = true;
+
+        // Arguments of unsigned conversions, ll values are formatted as long
+        auto readUnsigned = [&]() -> unsigned long {
+            if (isLongLong)
+                return (unsigned long)va_arg(args, unsigned long long);
+
+            return isLong ? va_arg(args, unsigned long) : (unsigned long)va_arg(args, unsigned int);
+        };
+
+        switch (c)
+        {
+            case 'd':
+            case 'i':
+                length = formatSigned(buffer, isLongLong ? (long)va_arg(args, long long) :
+                    isLong ? va_arg(args, long) : (long)va_arg(args, int));
+                break;
+
+            case 'u':
+                length = formatUnsigned(buffer, readUnsigned());
+                break;
+
+            case 'x':
+            case 'X':
+                length = formatHex(buffer, readUnsigned(), c == 'X');
+                break;
+
+            case 'f':
+                length = formatFixed(buffer, va_arg(args, double), precision < 0 ? 6 : (uint8_t)precision);
+                break;
+
+            case 'c':
+                buffer[0] = (char)va_arg(args, int);
+                length = 1;
+                isNumeric = false;
+                break;
+
+            case 's':
+                text = va_arg(args, const char*);
+                if (!text)
+                    text = "(null)";
+                length = strlen(text);
+                if (precision >= 0 && length > (size_t)precision)
+                    length = (size_t)precision;
+                isNumeric = false;
+                break;
+
+            case 'S':
+            {
+                // String stored in program memory, streamed without a RAM copy
+                const __FlashStringHelper* flashText = va_arg(args, const __FlashStringHelper*);
+                size_t flashLength = flashText ? strlen_P(reinterpret_cast<const char*>(flashText)) : 0;
+
+                for (size_t i = flashLength; !leftAlign && i < width; ++i)
+                    writeChar(' ');
+
+                if (flashLength > 0)
+                {
+                    writeFlash(flashText);
+                    last = (char)pgm_read_byte(reinterpret_cast<const char*>(flashText) + flashLength - 1);
+                }
+
+                for (size_t i = flashLength; leftAlign && i < width; ++i)
+                {
+                    writeChar(' ');
+                    last = ' ';
+                }
+
+                continue;
+            }
+
+            case '%':
+                buffer[0] = '%';
+                length = 1;
+                isNumeric = false;
+                break;
+
+            case '\0':
+                return last;
+
+            default:
+                // Unsupported specifier, written unchanged. Its argument is still consumed so the
+                // ones after it stay aligned with their conversions
+                if (c == 'e' || c == 'E' || c == 'g' || c == 'G' || c == 'a' || c == 'A')
+                    (void)va_arg(args, double);
+                else if (c == 'o')
+                    (void)readUnsigned();
+                else if (c == 'p')
+                    (void)va_arg(args, void*);
+
+                buffer[0] = '%';
+                buffer[1] = c;
+                length = 2;
+                isNumeric = false;
+                width = 0;
+                break;
+        }
+
+        if (width > length && leftAlign)
+        {
+            writeBytes(text, length);
+
+            for (size_t i = length; i < width; ++i)
+                writeChar(' ');
+
+            last = ' ';
+            continue;
+        }
+
+        if (width > length)
+        {
+            char padding = zeroPad && isNumeric ? '0' : ' ';
+
+            if (padding == '0' && text[0] == '-')
+            {
+                writeChar('-');
+                text++;
+                length--;
+                width--;
+            }
+
+            for (size_t i = length; i < width; ++i)
+                writeChar(padding);
+        }
+
+        writeBytes(text, length);
+
+        if (length > 0)
+            last = text[length - 1];
+    }
+
+    return last;
+}
 
 bool SerialCommandManager::processMessage()
 {
     if (_rawMessage[0] == '\0')
         return true;
 
-    sendDebug(_rawMessage, "SerialComdMgr-RawMessage:");
+    SCM_LOG_DEBUG(this, LogModuleLibrary, _rawMessage, F("SerialComdMgr-RawMessage:"));
+
+#if SCM_DIAGNOSTICS
+    _statMessages++;
+#endif
+
+#if SCM_DIAGNOSTICS || SCM_COMMAND_STATS
+    unsigned long start = micros();
+#endif
+
+    // Internal handlers first
+    bool handled = s_internalRegistry.dispatch(this, _command, _params, _paramCount) ||
+        (_registry && _registry->dispatch(this, _command, _params, _paramCount));
+
+#if SCM_DIAGNOSTICS || SCM_COMMAND_STATS
+    uint32_t elapsed = (uint32_t)(micros() - start);
+#endif
+
+#if SCM_COMMAND_STATS
+    recordCommand(elapsed, handled);
+#endif
+
+#if SCM_DIAGNOSTICS
+    _statDispatchMicros += elapsed;
 
+    if (elapsed > _statDispatchMax)
+        _statDispatchMax = elapsed;
+
+    if (!handled)
+        _statUnhandled++;
+#endif
+
+    return handled;
+}
+
+const char* SerialCommandRegistry::findCommand(const char* command) const
+{
+    for (size_t i = 0; i < _handlerCount; ++i)
+    {
+        size_t count;
+        const char* const* commands = _handlers[i]->supportedCommands(count);
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (strcmp(commands[j], command) == 0)
+                return commands[j];
+        }
+    }
+
+    return nullptr;
+}
+
+bool SerialCommandRegistry::dispatch(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount) const
+{
     for (size_t i = 0; i < _handlerCount; ++i)
     {
-        if (_handlerObjects[i]->supportsCommand(_command))
+        if (_handlers[i]->supportsCommand(command))
         {
-            if (_handlerObjects[i]->handleCommand(this, _command, _params, _paramCount))
+            SCM_TRACE(sender, TraceEvent::HandlerEnter);
+            bool handled = _handlers[i]->handleCommand(sender, command, params, paramCount);
+            SCM_TRACE(sender, TraceEvent::HandlerExit);
+
+            if (handled)
                 return true;
         }
     }
@@ -489,99 +1896,815 @@ bool SerialCommandManager::processMessage()
     return false;
 }
 
-void SerialCommandManager::sendMessage(const char* messageType, const char* message, const char* identifier)
+void SerialCommandManager::sendMessage(LogLevel level, const char* message, const char* identifier, const __FlashStringHelper* flashIdentifier)
 {
     if (!message || message[0] == '\0')
         return;
 
-    if (strcmp(messageType, "DEBUG") == 0 && !_isDebug)
+    if (captureLog(level, message, false, flashIdentifier))
         return;
 
-    _serialPort->print(messageType);
-    _serialPort->print(F(":"));
-    _serialPort->print(message);
-    
-    if (identifier && identifier[0] != '\0')
-    {
-        _serialPort->print(": (");
-        _serialPort->print(identifier);
-        _serialPort->print(")");
-    }
+    if (!allowMessage(level, message, false))
+        return;
+
+    if (!beginMessage(level >= LogLevel::Debug, level == LogLevel::Error))
+        return;
+
+    size_t length = strlen(message);
+
+    writeLogHeader(level);
+    writeBytes(message, length);
+    writeIdentifier(identifier, flashIdentifier);
     
-    if (!endsWith(message, _terminator))
-        _serialPort->print(_terminator);
+    if (message[length - 1] != _terminator)
+        writeChar(_terminator);
+
+    endMessage();
 }
 
-void SerialCommandManager::sendError(const char* message, const char* identifier)
+void SerialCommandManager::sendMessage(LogLevel level, const __FlashStringHelper* message, const char* identifier, const __FlashStringHelper* flashIdentifier)
 {
-    sendMessage("ERR", message, identifier);
-}
+    if (!message)
+        return;
 
-void SerialCommandManager::sendError(const char* message, const __FlashStringHelper* identifier) {
-    // Convert Flash string identifier to temporary C-string
-    char identifierBuffer[DefaultMaxParamKeyLength + 1];
+    const char* flashMessage = reinterpret_cast<const char*>(message);
+    size_t length = strlen_P(flashMessage);
 
-    // Copy Flash string to RAM buffer
-    strncpy_P(identifierBuffer, (const char*)identifier, DefaultMaxParamKeyLength);
-    identifierBuffer[DefaultMaxParamKeyLength] = '\0';
+    if (length == 0)
+        return;
 
-    sendError(message, identifierBuffer);
-}
+    if (captureLog(level, flashMessage, true, flashIdentifier))
+        return;
 
-void SerialCommandManager::sendError(const __FlashStringHelper* message, const __FlashStringHelper* identifier) {
-    // Convert Flash strings to temporary C-strings
-    char messageBuffer[_maxMessageLength];
-    char identifierBuffer[DefaultMaxParamKeyLength + 1];
-    
-    // Copy Flash string to RAM buffer
-    strncpy_P(messageBuffer, (const char*)message, _maxMessageLength - 1);
-    messageBuffer[_maxMessageLength - 1] = '\0';
-    
-    // Handle optional identifier
-    if (identifier != nullptr) {
-        strncpy_P(identifierBuffer, (const char*)identifier, DefaultMaxParamKeyLength);
-        identifierBuffer[DefaultMaxParamKeyLength] = '\0';
-        sendError(messageBuffer, identifierBuffer);
-    } else {
-        sendError(messageBuffer, "");
-    }
+    if (!allowMessage(level, flashMessage, true))
+        return;
+
+    if (!beginMessage(level >= LogLevel::Debug, level == LogLevel::Error))
+        return;
+
+    writeLogHeader(level);
+    writeFlash(message);
+    writeIdentifier(identifier, flashIdentifier);
+
+    if ((char)pgm_read_byte(flashMessage + length - 1) != _terminator)
+        writeChar(_terminator);
+
+    endMessage();
 }
 
-void SerialCommandManager::sendDebug(const char* message, const char* identifier)
+void SerialCommandManager::writeLogHeader(LogLevel level)
 {
-    sendMessage("DEBUG", message, identifier);
+    switch (level)
+    {
+        case LogLevel::Error:
+            writeFlash(F("ERR:"));
+            break;
+
+        case LogLevel::Warn:
+            writeFlash(F("WARN:"));
+            break;
+
+        case LogLevel::Info:
+            writeFlash(F("INFO:"));
+            break;
+
+        case LogLevel::Trace:
+            writeFlash(F("TRACE:"));
+            break;
+
+        default:
+            writeFlash(F("DEBUG:"));
+            break;
+    }
 }
 
-void SerialCommandManager::sendDebug(const __FlashStringHelper* message, const __FlashStringHelper* identifier) {
-    // Convert Flash strings to temporary C-strings
-    char messageBuffer[_maxMessageLength];
-    char identifierBuffer[DefaultMaxParamKeyLength + 1];
+bool SerialCommandManager::captureLog(LogLevel level, const char* message, bool messageInFlash, const __FlashStringHelper* flashIdentifier)
+{
+    if (!_logRecords || level < _logCaptureLevel)
+        return false;
 
-    // Copy Flash string to RAM buffer
-    strncpy_P(messageBuffer, (const char*)message, _maxMessageLength - 1);
-    messageBuffer[_maxMessageLength - 1] = '\0';
+    LogRecord& record = _logRecords[_logHead];
+    record.timestamp = millis();
+    record.level = (uint8_t)level;
+    record.isFlash = messageInFlash;
+    record.identifier = flashIdentifier;
 
-    // Handle optional identifier
-    if (identifier != nullptr) {
-        strncpy_P(identifierBuffer, (const char*)identifier, DefaultMaxParamKeyLength);
-        identifierBuffer[DefaultMaxParamKeyLength] = '\0';
-        sendDebug(messageBuffer, identifierBuffer);
+    // Flash strings are kept by reference, RAM strings may change so a short copy is kept
+    if (messageInFlash)
+    {
+        record.flashText = message;
     }
-    else {
-        sendDebug(messageBuffer, "");
+    else
+    {
+        size_t length = trimmedLength(message, LogRecordTextLength);
+        memcpy(record.text, message, length);
+        record.text[length] = '\0';
     }
+
+    _logHead = (uint8_t)((_logHead + 1) % _logSize);
+
+    if (_logCount < _logSize)
+        _logCount++;
+
+    return true;
 }
 
-void SerialCommandManager::sendDebug(const char* message, const __FlashStringHelper* identifier) {
-    // Convert Flash string identifier to temporary C-string
-    char identifierBuffer[DefaultMaxParamKeyLength + 1];
+#if !SCM_NO_HEAP
+bool SerialCommandManager::setLogBuffer(uint8_t records, LogLevel captureLevel)
+{
+    if (records == 0)
+        return setLogBuffer(nullptr, 0, captureLevel);
+
+    LogRecord* logRecords = new LogRecord[records];
 
-    // Handle optional identifier
-    if (identifier != nullptr) {
-        strncpy_P(identifierBuffer, (const char*)identifier, DefaultMaxParamKeyLength);
-        identifierBuffer[DefaultMaxParamKeyLength] = '\0';
-        sendDebug(message, identifierBuffer);
-    } else {
-        sendDebug(message, "");
+    if (!logRecords)
+    {
+        setLogBuffer(nullptr, 0, captureLevel);
+        return false;
     }
+
+    setLogBuffer(logRecords, logBufferSize(records), captureLevel);
+    _ownsLogRecords = true;
+    return true;
+}
+#endif
+
+bool SerialCommandManager::setLogBuffer(void* storage, size_t storageSize, LogLevel captureLevel)
+{
+#if !SCM_NO_HEAP
+    if (_ownsLogRecords)
+        delete[] _logRecords;
+#endif
+
+    size_t records = storage ? storageSize / sizeof(LogRecord) : 0;
+
+    _logRecords = records > 0 ? static_cast<LogRecord*>(storage) : nullptr;
+    _ownsLogRecords = false;
+    _logSize = records > 255 ? 255 : (uint8_t)records;
+    _logHead = 0;
+    _logCount = 0;
+    _logCaptureLevel = captureLevel;
+    return true;
+}
+
+uint8_t SerialCommandManager::getLogBufferSize()
+{
+    return _logSize;
+}
+
+uint8_t SerialCommandManager::getLogBufferCount()
+{
+    return _logCount;
+}
+
+void SerialCommandManager::clearLogBuffer()
+{
+    _logHead = 0;
+    _logCount = 0;
+}
+
+void SerialCommandManager::dumpLogBuffer()
+{
+    static const char levelCodes[] = "-EWIDT";
+
+    // Oldest record first
+    uint8_t index = (uint8_t)((_logHead + _logSize - _logCount) % _logSize);
+
+    for (uint8_t i = 0; i < _logCount; ++i)
+    {
+        const LogRecord& record = _logRecords[index];
+        index = (uint8_t)((index + 1) % _logSize);
+
+        if (!beginMessage(true))
+            continue;
+
+        char number[21];
+
+        // LOG:t=<ms>;l=<level>;m=<message>[;id=<identifier>]
+        writeBytes("LOG", 3);
+        writeChar(_commandSeparator);
+        writeChar('t');
+        writeChar(_keyValueSeparator);
+        writeBytes(number, formatUnsigned(number, record.timestamp));
+        writeChar(_paramSeparator);
+        writeChar('l');
+        writeChar(_keyValueSeparator);
+        writeChar(levelCodes[record.level <= (uint8_t)LogLevel::Trace ? record.level : 0]);
+        writeChar(_paramSeparator);
+        writeChar('m');
+        writeChar(_keyValueSeparator);
+
+        if (record.isFlash)
+            writeFlash(reinterpret_cast<const __FlashStringHelper*>(record.flashText));
+        else
+            writeText(record.text);
+
+        if (record.identifier)
+        {
+            writeChar(_paramSeparator);
+            writeBytes("id", 2);
+            writeChar(_keyValueSeparator);
+            writeFlash(record.identifier);
+        }
+
+        writeChar(_terminator);
+        endMessage();
+    }
+}
+
+SerialCommandManager::MessageRateLimit* SerialCommandManager::rateLimitFor(LogLevel level)
+{
+    if (level == LogLevel::Error)
+        return &_rateLimits[0];
+
+    if (level >= LogLevel::Debug)
+        return &_rateLimits[1];
+
+    return nullptr;
+}
+
+bool SerialCommandManager::allowMessage(LogLevel level, const char* message, bool messageInFlash)
+{
+    MessageRateLimit* limit = rateLimitFor(level);
+
+    if (!limit || (limit->burst == 0 && limit->sampleEvery <= 1))
+        return true;
+
+    bool allowed = true;
+
+    if (limit->sampleEvery > 1)
+    {
+        allowed = limit->sampleCounter == 0;
+
+        if (++limit->sampleCounter >= limit->sampleEvery)
+            limit->sampleCounter = 0;
+    }
+
+    if (allowed && limit->burst > 0)
+    {
+        unsigned long now = millis();
+        unsigned long refill = limit->refillMilliseconds > 0 ? (now - limit->lastRefill) / limit->refillMilliseconds : limit->burst;
+
+        if (refill > 0)
+        {
+            limit->tokens = refill >= (unsigned long)(limit->burst - limit->tokens) ? limit->burst : (uint8_t)(limit->tokens + refill);
+            limit->lastRefill = limit->tokens == limit->burst ? now : limit->lastRefill + refill * limit->refillMilliseconds;
+        }
+
+        if (limit->tokens > 0)
+            limit->tokens--;
+        else
+            allowed = false;
+    }
+
+    if (!allowed)
+    {
+        // Keep the start of the first suppressed message for the summary
+        if (limit->suppressed == 0)
+        {
+            if (messageInFlash)
+                strncpy_P(limit->suppressedText, message, sizeof(limit->suppressedText) - 1);
+            else
+                strncpy(limit->suppressedText, message, sizeof(limit->suppressedText) - 1);
+
+            limit->suppressedText[sizeof(limit->suppressedText) - 1] = '\0';
+        }
+
+        if (limit->suppressed < 0xFFFF)
+            limit->suppressed++;
+    }
+
+    return allowed;
+}
+
+void SerialCommandManager::sendSuppressedSummary()
+{
+    if (_rateLimits[0].suppressed == 0 && _rateLimits[1].suppressed == 0)
+        return;
+
+    unsigned long now = millis();
+
+    if (now - _lastSuppressedSummary < _suppressedSummaryInterval)
+        return;
+
+    _lastSuppressedSummary = now;
+
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        MessageRateLimit& limit = _rateLimits[i];
+        LogLevel level = i == 0 ? LogLevel::Error : LogLevel::Debug;
+
+        if (limit.suppressed == 0)
+            continue;
+
+        char count[11];
+        uint8_t countLength = formatUnsigned(count, limit.suppressed);
+        limit.suppressed = 0;
+
+        if (!isLogEnabled(level, LogModuleLibrary) || !beginMessage(level == LogLevel::Debug))
+            continue;
+
+        writeLogHeader(level);
+        writeText(limit.suppressedText);
+        writeBytes(" x", 2);
+        writeBytes(count, countLength);
+        writeFlash(F(" suppressed"));
+        writeChar(_terminator);
+        endMessage();
+    }
+}
+
+void SerialCommandManager::setRateLimit(LogLevel level, uint8_t burst, uint16_t refillMilliseconds)
+{
+    MessageRateLimit* limit = rateLimitFor(level);
+
+    if (!limit)
+        return;
+
+    limit->burst = burst;
+    limit->tokens = burst;
+    limit->refillMilliseconds = refillMilliseconds;
+    limit->lastRefill = burst > 0 ? millis() : 0;
+}
+
+void SerialCommandManager::setSampling(LogLevel level, uint8_t everyN)
+{
+    MessageRateLimit* limit = rateLimitFor(level);
+
+    if (!limit)
+        return;
+
+    limit->sampleEvery = everyN;
+    limit->sampleCounter = 0;
+}
+
+void SerialCommandManager::setSuppressedSummaryInterval(uint16_t milliseconds)
+{
+    _suppressedSummaryInterval = milliseconds;
+}
+
+uint16_t SerialCommandManager::getSuppressedCount(LogLevel level)
+{
+    MessageRateLimit* limit = rateLimitFor(level);
+    return limit ? limit->suppressed : 0;
+}
+
+void SerialCommandManager::setCompactErrors(bool compact)
+{
+    _compactErrors = compact;
+}
+
+bool SerialCommandManager::getCompactErrors()
+{
+#if SCM_ERROR_TEXT
+    return _compactErrors;
+#else
+    return true;
+#endif
+}
+
+const __FlashStringHelper* SerialCommandManager::getErrorText(ErrorCode code)
+{
+#if SCM_ERROR_TEXT
+    switch (code)
+    {
+        case ErrorCode::RawBufferFull:
+            return F("Raw buffer full");
+
+        case ErrorCode::MessageBufferFull:
+            return F("Message buffer full");
+
+        case ErrorCode::ParamKeyTooLong:
+            return F("Param key too long");
+
+        case ErrorCode::ParamValueTooLong:
+            return F("Param value too long");
+
+        case ErrorCode::MessageTooLong:
+            return F("Too Long");
+
+        case ErrorCode::Timeout:
+            return F("Timeout");
+
+        case ErrorCode::TxOverflow:
+            return F("TX overflow");
+
+        default:
+            return nullptr;
+    }
+#else
+    (void)code;
+    return nullptr;
+#endif
+}
+
+void SerialCommandManager::sendLibraryError(ErrorCode code)
+{
+#if SCM_DIAGNOSTICS
+    _statErrors++;
+#endif
+
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_ERROR
+    if (!isLogEnabled(LogLevel::Error, LogModuleLibrary))
+        return;
+
+    const __FlashStringHelper* text = getCompactErrors() ? nullptr : getErrorText(code);
+
+    if (text)
+    {
+        sendMessage(LogLevel::Error, text, nullptr, F("SerialCommandManager"));
+    }
+    else
+    {
+        char number[4];
+        formatUnsigned(number, (uint8_t)code);
+        sendMessage(LogLevel::Error, number, nullptr, nullptr);
+    }
+#else
+    (void)code;
+#endif
+}
+
+void SerialCommandManager::writeIdentifier(const char* identifier, const __FlashStringHelper* flashIdentifier)
+{
+    if (flashIdentifier && pgm_read_byte(reinterpret_cast<const char*>(flashIdentifier)) != '\0')
+    {
+        writeBytes(": (", 3);
+        writeFlash(flashIdentifier);
+        writeChar(')');
+    }
+    else if (identifier && identifier[0] != '\0')
+    {
+        writeBytes(": (", 3);
+        writeText(identifier);
+        writeChar(')');
+    }
+}
+
+bool SerialCommandManager::beginMessage(bool isDebug, bool isUrgent)
+{
+    if (!_txBuffer)
+    {
+        SCM_TRACE(this, TraceEvent::TxStart);
+        return true;
+    }
+
+    _txFrameHead = _txHead;
+    _txFrameCount = _txCount;
+    _txFrameIsDebug = isDebug;
+    _txFrameIsUrgent = isUrgent;
+    _txFrameDropped = false;
+
+    // Keep the last quarter of the buffer for non debug messages
+    if (isDebug && _txOverflowPolicy == TxOverflowPolicy::DropDebug && 
+        _txCount >= _txBufferSize - (_txBufferSize / 4))
+    {
+        _txDropped++;
+        return false;
+    }
+
+    SCM_TRACE(this, TraceEvent::TxStart);
+    return true;
+}
+
+void SerialCommandManager::endMessage(bool spendsCredit)
+{
+    SCM_TRACE(this, TraceEvent::TxEnd);
+
+    // Every message sent occupies a slot in the peer's receive buffer, except CREDIT frames
+    if (_flowControl == FlowControl::Credit && spendsCredit && !(_txBuffer && _txFrameDropped))
+        spendCredit();
+
+    if (!_txBuffer)
+        return;
+
+    if (_batchDeadline > 0 && !_txFrameDropped)
+    {
+        // The deadline runs from the first message in the batch
+        if (_txFrameCount == 0)
+            _batchStart = millis();
+
+        // Urgent messages send the batch ahead of them straight away, keeping the order
+        if (_txFrameIsUrgent)
+            flushBatch();
+    }
+
+    _txFrameDropped = false;
+}
+
+void SerialCommandManager::queueBytes(const char* data, size_t length)
+{
+    while (length > 0 && !_txFrameDropped)
+    {
+        uint16_t space = _txBufferSize - _txCount;
+
+        if (space == 0)
+        {
+            // Only Block waits on the wire, DropDebug sends what the port takes now and otherwise drops
+            // the message. Debug messages already leave it the last quarter of the buffer
+            if (_txOverflowPolicy == TxOverflowPolicy::Block || 
+                (_txOverflowPolicy == TxOverflowPolicy::DropDebug && !_txFrameIsDebug))
+            {
+                drainTx(_txOverflowPolicy == TxOverflowPolicy::Block);
+
+                if (_txCount < _txBufferSize)
+                    continue;
+            }
+
+            // Discard the partially queued message so only complete messages are sent
+            _txHead = _txFrameHead;
+            _txCount = _txFrameCount;
+            _txFrameDropped = true;
+            _txDropped++;
+            _txDroppedUnreported++;
+            return;
+        }
+
+        size_t chunk = _txBufferSize - _txHead;
+
+        if (chunk > space)
+            chunk = space;
+
+        if (chunk > length)
+            chunk = length;
+
+        memcpy(_txBuffer + _txHead, data, chunk);
+        _txHead = (uint16_t)((_txHead + chunk) % _txBufferSize);
+        _txCount += (uint16_t)chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void SerialCommandManager::drainTx(bool blocking)
+{
+    // Hold output while the peer has sent XOFF, even when blocking. XON is only read between messages,
+    // so a blocking caller hands back to its overflow policy rather than waiting
+    if (_peerPaused)
+        return;
+
+    while (_txCount > 0)
+    {
+        size_t chunk = _txBufferSize - _txTail;
+
+        if (chunk > _txCount)
+            chunk = _txCount;
+
+        if (!blocking)
+        {
+            int room = _serialPort->availableForWrite();
+
+            if (room <= 0)
+                return;
+
+            if (chunk > (size_t)room)
+                chunk = (size_t)room;
+        }
+
+        size_t written = _serialPort->write(reinterpret_cast<const uint8_t*>(_txBuffer + _txTail), chunk);
+
+        if (written == 0)
+            return;
+
+        _txTail = (uint16_t)((_txTail + written) % _txBufferSize);
+        _txCount -= (uint16_t)written;
+    }
+}
+
+void SerialCommandManager::writeBytes(const char* data, size_t length)
+{
+    if (length == 0)
+        return;
+
+    if (_txBuffer)
+        queueBytes(data, length);
+    else
+        _serialPort->write(reinterpret_cast<const uint8_t*>(data), length);
+}
+
+void SerialCommandManager::writeText(const char* text)
+{
+    if (text)
+        writeBytes(text, strlen(text));
+}
+
+void SerialCommandManager::writeFlash(const __FlashStringHelper* text)
+{
+    if (!text)
+        return;
+
+    // Stream from program memory in small chunks, no full size RAM copy is made
+    const char* flashText = reinterpret_cast<const char*>(text);
+    char chunk[16];
+    size_t length = 0;
+    char c;
+
+    while ((c = (char)pgm_read_byte(flashText++)) != '\0')
+    {
+        chunk[length++] = c;
+
+        if (length == sizeof(chunk))
+        {
+            writeBytes(chunk, length);
+            length = 0;
+        }
+    }
+
+    writeBytes(chunk, length);
+}
+
+void SerialCommandManager::writeChar(char c)
+{
+    if (_txBuffer)
+        queueBytes(&c, 1);
+    else
+        _serialPort->write((uint8_t)c);
+}
+
+void SerialCommandManager::setLogLevel(uint8_t module, LogLevel level)
+{
+    // getLogLevel() and isLogEnabled() report what the binary can actually send
+    if ((uint8_t)level > SCM_LOG_LEVEL)
+        level = (LogLevel)SCM_LOG_LEVEL;
+
+    if (module < LogModuleCount)
+        _logLevels[module] = (uint8_t)level;
+}
+
+LogLevel SerialCommandManager::getLogLevel(uint8_t module)
+{
+    if (module >= LogModuleCount)
+        return LogLevel::None;
+
+    return (LogLevel)_logLevels[module];
+}
+
+void SerialCommandManager::sendLog(LogLevel level, uint8_t module, const char* message, const char* identifier)
+{
+    if (isLogEnabled(level, module))
+        sendMessage(level, message, identifier, nullptr);
+}
+
+void SerialCommandManager::sendLog(LogLevel level, uint8_t module, const __FlashStringHelper* message, const __FlashStringHelper* identifier)
+{
+    if (isLogEnabled(level, module))
+        sendMessage(level, message, nullptr, identifier);
+}
+
+void SerialCommandManager::sendLog(LogLevel level, uint8_t module, const char* message, const __FlashStringHelper* identifier)
+{
+    if (isLogEnabled(level, module))
+        sendMessage(level, message, nullptr, identifier);
+}
+
+void SerialCommandManager::sendError(const char* message, const char* identifier)
+{
+    if (isLogEnabled(LogLevel::Error))
+        sendMessage(LogLevel::Error, message, identifier, nullptr);
+}
+
+void SerialCommandManager::sendError(const char* message, const __FlashStringHelper* identifier)
+{
+    if (isLogEnabled(LogLevel::Error))
+        sendMessage(LogLevel::Error, message, nullptr, identifier);
+}
+
+void SerialCommandManager::sendError(const __FlashStringHelper* message, const __FlashStringHelper* identifier)
+{
+    if (isLogEnabled(LogLevel::Error))
+        sendMessage(LogLevel::Error, message, nullptr, identifier);
+}
+
+void SerialCommandManager::sendDebug(const char* message, const char* identifier)
+{
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_DEBUG
+    if (isLogEnabled(LogLevel::Debug))
+        sendMessage(LogLevel::Debug, message, identifier, nullptr);
+#else
+    (void)message;
+    (void)identifier;
+#endif
+}
+
+void SerialCommandManager::sendDebug(const __FlashStringHelper* message, const __FlashStringHelper* identifier)
+{
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_DEBUG
+    if (isLogEnabled(LogLevel::Debug))
+        sendMessage(LogLevel::Debug, message, nullptr, identifier);
+#else
+    (void)message;
+    (void)identifier;
+#endif
+}
+
+void SerialCommandManager::sendDebug(const char* message, const __FlashStringHelper* identifier)
+{
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_DEBUG
+    if (isLogEnabled(LogLevel::Debug))
+        sendMessage(LogLevel::Debug, message, nullptr, identifier);
+#else
+    (void)message;
+    (void)identifier;
+#endif
+}
+
+
+// parameter builder
+
+ParamBuilder::ParamBuilder(SerialCommandManager* manager)
+    : _manager(manager), _hasParams(false)
+{
+}
+
+ParamBuilder::ParamBuilder(ParamBuilder&& other)
+    : _manager(other._manager), _hasParams(other._hasParams)
+{
+    other._manager = nullptr;
+}
+
+ParamBuilder::~ParamBuilder()
+{
+    send();
+}
+
+bool ParamBuilder::beginParam(const char* key)
+{
+    if (!_manager || !key)
+        return false;
+
+    // First parameter follows the header/message, the rest are separated from each other
+    _manager->writeChar(_hasParams ? _manager->_paramSeparator : _manager->_commandSeparator);
+    _manager->writeText(key);
+    _manager->writeChar(_manager->_keyValueSeparator);
+    _hasParams = true;
+    return true;
+}
+
+ParamBuilder& ParamBuilder::kv(const char* key, const char* value)
+{
+    if (beginParam(key))
+        _manager->writeText(value);
+
+    return *this;
+}
+
+ParamBuilder& ParamBuilder::kv(const char* key, const __FlashStringHelper* value)
+{
+    if (beginParam(key))
+        _manager->writeFlash(value);
+
+    return *this;
+}
+
+ParamBuilder& ParamBuilder::kv(const char* key, int value)
+{
+    return kv(key, (long)value);
+}
+
+ParamBuilder& ParamBuilder::kv(const char* key, unsigned int value)
+{
+    return kv(key, (unsigned long)value);
+}
+
+ParamBuilder& ParamBuilder::kv(const char* key, long value)
+{
+    if (beginParam(key))
+    {
+        char digits[22];
+        _manager->writeBytes(digits, formatSigned(digits, value));
+    }
+
+    return *this;
+}
+
+ParamBuilder& ParamBuilder::kv(const char* key, unsigned long value)
+{
+    if (beginParam(key))
+    {
+        char digits[21];
+        _manager->writeBytes(digits, formatUnsigned(digits, value));
+    }
+
+    return *this;
+}
+
+ParamBuilder& ParamBuilder::kv(const char* key, double value, uint8_t decimals)
+{
+    if (beginParam(key))
+    {
+        char digits[24];
+        _manager->writeBytes(digits, formatFixed(digits, value, decimals));
+    }
+
+    return *this;
+}
+
+void ParamBuilder::send()
+{
+    if (!_manager)
+        return;
+
+    _manager->writeChar(_manager->_terminator);
+    _manager->endMessage();
+    _manager = nullptr;
 }
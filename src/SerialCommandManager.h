@@ -3,6 +3,7 @@
 
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <Arduino.h>
 
 
@@ -12,11 +13,125 @@
  #define YIELD
 #endif
 
+// Log levels, SCM_LOG_LEVEL selects the highest level compiled into the binary.
+// Calls made through the SCM_LOG_* macros above that level are removed entirely.
+#define SCM_LOG_LEVEL_NONE 0
+#define SCM_LOG_LEVEL_ERROR 1
+#define SCM_LOG_LEVEL_WARN 2
+#define SCM_LOG_LEVEL_INFO 3
+#define SCM_LOG_LEVEL_DEBUG 4
+#define SCM_LOG_LEVEL_TRACE 5
+
+#ifndef SCM_LOG_LEVEL
+ #define SCM_LOG_LEVEL SCM_LOG_LEVEL_DEBUG
+#endif
+
+// Support for sending from several tasks/threads (ConcurrentStream, DeferredDispatchHandler),
+// requires std::atomic so it is only enabled on ESP32 and native hosts by default.
+#ifndef SCM_CONCURRENT
+ #if defined(ESP32) || defined(__linux__) || defined(__APPLE__)
+  #define SCM_CONCURRENT 1
+ #else
+  #define SCM_CONCURRENT 0
+ #endif
+#endif
+
+#if SCM_CONCURRENT
+ #include <atomic>
+#endif
+
+// Set SCM_ERROR_TEXT to 0 to remove the library error descriptions from flash, errors are
+// then always sent as ERR:<code> and decoded on the host using the ErrorCode catalogue.
+#ifndef SCM_ERROR_TEXT
+ #define SCM_ERROR_TEXT 1
+#endif
+
+// Set SCM_DIAGNOSTICS to 1 to build in the MEM, STATS, PING and PERF commands and the counters behind them.
+#ifndef SCM_DIAGNOSTICS
+ #define SCM_DIAGNOSTICS 0
+#endif
+
+// Set SCM_COMMAND_STATS to the number of commands to keep counters and handler time histograms for,
+// 0 compiles them out. Commands no handler lists share one "*" entry.
+#ifndef SCM_COMMAND_STATS
+ #define SCM_COMMAND_STATS 0
+#endif
+
+// Set SCM_NO_HEAP to 1 for builds that forbid heap allocation. The constructor and setters that
+// allocate are then deleted, so using one fails the build, use the caller storage overloads instead.
+#ifndef SCM_NO_HEAP
+ #define SCM_NO_HEAP 0
+#endif
+
 const uint8_t MaximumParameterCount = 5;
 const uint8_t DefaultMaxCommandLength = 20;
 const uint8_t DefaultMaxParamKeyLength = 10;
 const uint8_t DefaultMaxParamValueLength = 64;
 const uint8_t DefaultMaxMessageLength = 128;
+const uint8_t LogRecordTextLength = 13;
+const uint8_t CorrelationIdLength = 11;
+const uint8_t FlowXon = 0x11;
+const uint8_t FlowXoff = 0x13;
+const uint8_t MinimumStorageSize = 3;          // Caller storage for an empty command and a 1 byte message
+const uint8_t TxOverflowReportLength = 32;     // Room kept for ERR:TX overflow:dropped=<n>, smallest Report buffer
+
+const uint8_t CommandStatsBuckets = 16;
+
+// Reserved parameter key carrying a request correlation id, e.g. LED:#=42;pin=13
+#define SCM_CORRELATION_KEY "#"
+
+/**
+ * @brief Severity of a log message, see SCM_LOG_LEVEL and SerialCommandManager::setLogLevel().
+ */
+enum class LogLevel : uint8_t {
+    None = SCM_LOG_LEVEL_NONE,
+    Error = SCM_LOG_LEVEL_ERROR,
+    Warn = SCM_LOG_LEVEL_WARN,
+    Info = SCM_LOG_LEVEL_INFO,
+    Debug = SCM_LOG_LEVEL_DEBUG,
+    Trace = SCM_LOG_LEVEL_TRACE
+};
+
+// Log modules, each module has its own runtime log level
+const uint8_t LogModuleCount = 8;
+const uint8_t LogModuleDefault = 0;     // sendDebug()/sendError() and application messages
+const uint8_t LogModuleLibrary = 1;     // messages generated by SerialCommandManager itself
+                                        // modules 2 - 7 are free for application use
+
+/**
+ * @brief Errors reported by the library itself, sent as ERR:<code> in compact error mode.
+ * 
+ * The numeric values are part of the wire protocol, existing codes never change.
+ */
+enum class ErrorCode : uint8_t {
+    None = 0,
+    RawBufferFull = 1,      // "Raw buffer full", the incoming message exceeded the maximum message length
+    MessageBufferFull = 2,  // "Message buffer full", no longer raised, RawBufferFull covers it
+    ParamKeyTooLong = 3,    // "Param key too long"
+    ParamValueTooLong = 4,  // "Param value too long"
+    MessageTooLong = 5,     // "Too Long", no longer raised, RawBufferFull covers it
+    Timeout = 6,            // "Timeout", no terminator received within the serial timeout
+    TxOverflow = 7          // "TX overflow", messages were dropped by the transmit buffer
+};
+
+/**
+ * @brief Policy applied when the optional transmit buffer cannot hold an outgoing message.
+ */
+enum class TxOverflowPolicy : uint8_t {
+    DropDebug,  // debug messages are dropped once the buffer is 3/4 full, other messages once they do not fit
+    Block,      // wait for the serial port to drain, no messages are dropped unless the peer has sent XOFF
+    Report      // drop any message that does not fit and report the drop count with an ERR message, needs a
+                // buffer of at least TxOverflowReportLength bytes
+};
+
+/**
+ * @brief Flow control between a pipelining sender and a receiver, see SerialCommandManager::setFlowControl().
+ */
+enum class FlowControl : uint8_t {
+    None,       // the sender must not outrun the receiver
+    Credit,     // the receiver grants message slots with CREDIT messages, the sender spends one per message
+    XonXoff     // the receiver sends XOFF when its receive buffer fills and XON once it has drained
+};
 
 /**
  * @brief Structure representing a key/value parameter pair.
@@ -28,6 +143,57 @@ typedef struct StringKeyValue {
     char value[DefaultMaxParamValueLength + 1];
 } keyAndValue;
 
+#if SCM_COMMAND_STATS
+/**
+ * @brief Counters and handler time histogram for one command, see SCM_COMMAND_STATS.
+ * 
+ * Histogram bucket i counts handler calls taking 2^i to 2^(i+1)-1 microseconds (bucket 0 also
+ * counts 0), the last bucket counts all longer calls. Bucket counts stop at 65535.
+ */
+struct CommandStats {
+    const char* command;        // Command as listed by its handler, "*" for commands no handler lists
+    uint32_t received;          // Messages received
+    uint32_t handled;           // Messages a handler handled
+    uint32_t failed;            // Messages the supporting handlers returned false for
+    uint32_t fellThrough;       // Unhandled messages passed to the MessageReceivedCallback
+    uint16_t histogram[CommandStatsBuckets];
+};
+#endif
+
+/**
+ * @brief Points in the receive, dispatch and transmit path reported to SCM_TRACE_HOOK.
+ */
+enum class TraceEvent : uint8_t {
+    FirstByte,          // first character of a message read
+    Terminator,         // terminator read, the message is complete
+    CommandResolved,    // command and parameters parsed, about to dispatch
+    HandlerEnter,       // a handler's handleCommand() is being called
+    HandlerExit,        // the handler returned
+    TxStart,            // an outgoing message is started
+    TxEnd               // the outgoing message is complete (written, or queued with setTxBuffer())
+};
+
+// Trace points, define SCM_TRACE_HOOK (e.g. -DSCM_TRACE_HOOK=onTrace) to have the library call
+// void onTrace(SerialCommandManager* manager, TraceEvent event, uint32_t timestamp) at each
+// TraceEvent, defined by the application. To inline the hook, for instance a GPIO toggle, instead
+// define SCM_TRACE_INCLUDE as a header that defines SCM_TRACE_HOOK as a macro or inline function.
+// The timestamp is micros() unless SCM_TRACE_CLOCK() is defined, e.g. as a cycle counter. Without a
+// hook the trace points compile to nothing.
+#if defined(SCM_TRACE_INCLUDE)
+ #include SCM_TRACE_INCLUDE
+#elif defined(SCM_TRACE_HOOK)
+ void SCM_TRACE_HOOK(class SerialCommandManager* manager, TraceEvent event, uint32_t timestamp);
+#endif
+
+#ifdef SCM_TRACE_HOOK
+ #ifndef SCM_TRACE_CLOCK
+  #define SCM_TRACE_CLOCK() micros()
+ #endif
+ #define SCM_TRACE(manager, event) SCM_TRACE_HOOK((manager), (event), (uint32_t)SCM_TRACE_CLOCK())
+#else
+ #define SCM_TRACE(manager, event) do { } while (0)
+#endif
+
 /**
  * @brief Callback function type for message reception.
  * 
@@ -92,6 +258,104 @@ public:
     virtual ~ISerialCommandHandler() {}
 };
 
+/**
+ * @brief Immutable list of command handlers that can be shared by any number of managers.
+ * 
+ * The registry does not copy or own the handler array, so one registry, built once (as a
+ * constant when the handlers are globals), can serve many SerialCommandManager instances
+ * leaving each manager with only its parser state and buffers.
+ *
+ * Example:
+ * `
+ * ISerialCommandHandler* const handlers[] = { &motorHandler, &ledHandler };
+ * const SerialCommandRegistry registry(handlers);
+ *
+ * hostMgr.setRegistry(&registry);
+ * displayMgr.setRegistry(&registry);
+ * `
+ */
+class SerialCommandRegistry
+{
+private:
+    ISerialCommandHandler* const* _handlers;
+    size_t _handlerCount;
+
+public:
+    /**
+     * @brief Constructs a registry over an existing array of handlers.
+     * 
+     * @param handlers Array of pointers to ISerialCommandHandler objects, must outlive the registry.
+     * @param handlerCount Number of handlers in the array.
+     */
+    constexpr SerialCommandRegistry(ISerialCommandHandler* const* handlers, size_t handlerCount)
+        : _handlers(handlers), _handlerCount(handlers ? handlerCount : 0)
+    {
+    }
+
+    /**
+     * @brief Constructs a registry over an array of handlers, taking the count from the array.
+     * 
+     * @param handlers Array of pointers to ISerialCommandHandler objects, must outlive the registry.
+     */
+    template <size_t N>
+    constexpr SerialCommandRegistry(ISerialCommandHandler* const (&handlers)[N])
+        : _handlers(handlers), _handlerCount(N)
+    {
+    }
+
+    /**
+     * @brief Passes a command to the first handler that supports and handles it.
+     * 
+     * @param sender The manager that received the command, replies are sent through it.
+     * @param command The command string that was received.
+     * @param params Array of key-value parameter pairs.
+     * @param paramCount Number of parameters in the array.
+     * @return true if a handler handled the command.
+     */
+    bool dispatch(SerialCommandManager* sender, const char* command, const StringKeyValue params[], uint8_t paramCount) const;
+
+    /**
+     * @brief Gets the handler array.
+     * 
+     * @return Array of handlers, nullptr if empty.
+     */
+    ISerialCommandHandler* const* getHandlers() const
+    {
+        return _handlers;
+    }
+
+    /**
+     * @brief Finds the command string a handler lists for command.
+     * 
+     * @param command The command string that was received.
+     * @return The handler's own copy of the command, nullptr if no handler lists it.
+     */
+    const char* findCommand(const char* command) const;
+
+    /**
+     * @brief Gets a handler by position.
+     * 
+     * @param index Position of the handler.
+     * @return The handler, nullptr if index is out of range.
+     */
+    ISerialCommandHandler* getHandler(size_t index) const
+    {
+        return index < _handlerCount ? _handlers[index] : nullptr;
+    }
+
+    /**
+     * @brief Gets the number of handlers in the registry.
+     * 
+     * @return Handler count.
+     */
+    size_t getHandlerCount() const
+    {
+        return _handlerCount;
+    }
+};
+
+class ParamBuilder;
+
 /**
  * @brief Manages serial command parsing and dispatching to registered handlers.
  * 
@@ -122,18 +386,55 @@ public:
 class SerialCommandManager
 {
     friend class DebugHandler;
+    friend class CreditHandler;
+    friend class DiagnosticsHandler;
+    friend class ParamBuilder;
+    friend class DeferredDispatchHandler;
 private:
-    ISerialCommandHandler** _handlerObjects;
-    size_t _handlerCount = 0;
+    /**
+     * @brief Rate limit and sampling state for one message type (errors or debug/trace).
+     */
+    struct MessageRateLimit {
+        uint8_t burst = 0;                  // Token bucket size, 0 disables rate limiting
+        uint8_t tokens = 0;                 // Messages that can be sent now
+        uint16_t refillMilliseconds = 0;    // Time to regain one token
+        unsigned long lastRefill = 0;       // Time tokens were last added
+        uint8_t sampleEvery = 0;            // Send 1 in N messages, 0 or 1 sends all
+        uint8_t sampleCounter = 0;          // Position within the current sample
+        uint16_t suppressed = 0;            // Messages suppressed since the last summary
+        char suppressedText[17] = {};       // Start of the first suppressed message
+    };
+
+    /**
+     * @brief Compact log buffer entry, flash messages are kept by reference, RAM messages as a short copy.
+     */
+    struct LogRecord {
+        unsigned long timestamp;                    // millis() when the message was logged
+        uint8_t level;                              // LogLevel of the message
+        bool isFlash;                               // flashText is valid rather than text
+        const __FlashStringHelper* identifier;      // Flash identifier, nullptr if none
+        union {
+            const char* flashText;                  // Message stored in program memory
+            char text[LogRecordTextLength + 1];     // Start of a RAM message
+        };
+    };
+
+    const SerialCommandRegistry* _registry = nullptr;   // Handlers in use, owned or shared
+    SerialCommandRegistry _ownedRegistry{nullptr, 0};   // Registry built by registerHandlers()
+    ISerialCommandHandler** _handlerSlots = nullptr;    // Caller storage for registerHandlers(), nullptr to allocate
+    size_t _handlerSlotCount = 0;                       // Number of caller handler slots
+    bool _ownsBuffers = true;                           // Message buffers were allocated by the constructor
     bool _readingMessage = false;
     bool _isParsingCommand = true;
     bool _isParsingParamName = true;
     unsigned long _lastCharTime = 0;
     
-    // Buffer management
-    char* _incomingMessage;        // Dynamic buffer for incoming message
+    // Buffer management, the raw message is the only copy of the whole message
     char* _command;                // Dynamic buffer for parsed command
     char* _rawMessage;             // Dynamic buffer for raw message
+    uint8_t _rawLength = 0;        // Characters in the raw message
+    uint8_t _commandLength = 0;    // Characters in the command
+    uint8_t _fieldLength = 0;      // Characters in the parameter key or value being parsed
     uint8_t _maxCommandLength;     // Max command buffer size
     uint8_t _maxMessageLength;     // Max message buffer size
     
@@ -146,9 +447,85 @@ private:
     char _commandSeparator;
     char _paramSeparator;
 	char _keyValueSeparator;
+#if SCM_CONCURRENT
+    std::atomic<bool> _isDebug;     // Set by DEBUG on the receiving task, read by every sender
+#else
     bool _isDebug;
+#endif
+    uint8_t _logLevels[LogModuleCount]; // Runtime log level per module
     MessageReceivedCallback _messageReceivedCallback;
 
+    // Optional transmit ring buffer
+    char* _txBuffer = nullptr;      // Dynamic buffer for queued output, nullptr writes directly to the port
+    bool _ownsTxBuffer = false;     // Transmit buffer was allocated by setTxBuffer()
+    uint16_t _txBufferSize = 0;     // Size of the transmit buffer
+    uint16_t _txHead = 0;           // Next write position
+    uint16_t _txTail = 0;           // Next byte to send
+    uint16_t _txCount = 0;          // Bytes waiting to be sent
+    uint16_t _txFrameHead = 0;      // Head position when the current message started
+    uint16_t _txFrameCount = 0;     // Byte count when the current message started
+    bool _txFrameIsDebug = false;   // Current message is a debug message
+    bool _txFrameDropped = false;   // Current message did not fit and is being discarded
+    bool _txFrameIsUrgent = false;  // Current message flushes the batch when complete
+    TxOverflowPolicy _txOverflowPolicy = TxOverflowPolicy::DropDebug;
+    uint16_t _txDropped = 0;        // Total messages dropped
+    uint16_t _txDroppedUnreported = 0; // Messages dropped since the last overflow report
+
+    // Optional batching of queued output
+    uint16_t _batchDeadline = 0;        // Maximum time a message waits in the batch, 0 when disabled
+    unsigned long _batchStart = 0;      // Time the first message of the batch was queued
+    bool _batchFlush = false;           // Batch is being sent, drain regardless of the deadline
+
+    // Rate limiting of error [0] and debug/trace [1] messages
+    MessageRateLimit _rateLimits[2];
+    uint16_t _suppressedSummaryInterval = 1000;
+    unsigned long _lastSuppressedSummary = 0;
+
+    // Optional log buffer, captures messages instead of sending them
+    LogRecord* _logRecords = nullptr;   // Dynamic buffer of log records, nullptr when disabled
+    bool _ownsLogRecords = false;       // Log records were allocated by setLogBuffer()
+    uint8_t _logSize = 0;               // Number of records in the buffer
+    uint8_t _logHead = 0;               // Next record to write
+    uint8_t _logCount = 0;              // Records in use
+    LogLevel _logCaptureLevel = LogLevel::Debug;
+
+    bool _compactErrors = false;    // Library errors are sent as ERR:<code>
+
+    char _correlationId[CorrelationIdLength + 1] = "";   // Id of the message being handled, echoed in ACKs
+
+    // Optional flow control
+    FlowControl _flowControl = FlowControl::None;
+    uint16_t _flowWindow = 0;       // Receive slots (Credit) or receive buffer bytes (XonXoff), 0 when only sending
+    uint16_t _creditsToGrant = 0;   // Messages read since credit was last granted to the peer
+#if SCM_CONCURRENT
+    std::atomic<uint16_t> _peerCredits{0};  // Messages the peer can accept, granted on the receiving task, spent by every sender
+#else
+    uint16_t _peerCredits = 0;      // Messages the peer can accept
+#endif
+    bool _xoffSent = false;         // Peer has been told to stop sending
+    bool _peerPaused = false;       // Peer sent XOFF, queued output is held
+    bool _creditRequested = false;  // Asked the peer for its window, accept the next advertisement
+
+#if SCM_DIAGNOSTICS
+    // Diagnostics counters reported by STATS and PERF
+    uint32_t _statMessages = 0;         // Messages received
+    uint32_t _statUnhandled = 0;        // Messages no handler accepted
+    uint32_t _statErrors = 0;           // Library errors raised
+    uint32_t _statDispatchMicros = 0;   // Total time spent in handlers
+    uint32_t _statDispatchMax = 0;      // Longest time spent in a handler
+    unsigned long _perfStart = 0;       // micros() when the PERF window started
+    uint32_t _perfBusyMicros = 0;       // Time spent in readCommands() during the window
+    uint32_t _perfCalls = 0;            // readCommands() calls during the window
+#endif
+
+#if SCM_COMMAND_STATS
+    // Per command counters and timings, see SCM_COMMAND_STATS
+    CommandStats _commandStats[SCM_COMMAND_STATS] = {};
+    uint8_t _commandStatsCount = 0;                     // Entries in use
+    uint16_t _parseHistogram[CommandStatsBuckets] = {}; // Time from first byte to terminator
+    unsigned long _parseStart = 0;                      // micros() when the message started
+#endif
+
     /**
      * @brief Processes the incoming message and dispatches to handlers.
      * 
@@ -157,147 +534,1114 @@ private:
     bool processMessage();
 
     /**
-     * @brief Sends a message over the serial port.
+     * @brief Sends a log message over the serial port, the caller has checked isLogEnabled().
      * 
-     * @param messageType The type of message (e.g., "DEBUG", "ERROR").
+     * @param level The message level, selects the message type (e.g. "DEBUG", "ERR").
      * @param message The message content.
      * @param identifier Optional identifier for the message.
+     * @param flashIdentifier Optional identifier stored in program memory, used in preference to identifier.
      */
-    void sendMessage(const char* messageType, const char* message, const char* identifier);
+    void sendMessage(LogLevel level, const char* message, const char* identifier, const __FlashStringHelper* flashIdentifier);
 
-public:
     /**
-     * @brief Constructs a SerialCommandManager instance.
+     * @brief Sends a log message stored in program memory, the caller has checked isLogEnabled().
      * 
-     * @param serialPort Pointer to the Stream object for serial communication.
-     * @param commandReceived Callback function for received commands.
-     * @param terminator Character that terminates a command message.
-     * @param commandSeparator Character that separates command from parameters.
-     * @param paramSeparator Character that separates parameters.
-	 * @param keyValueSeparator Character that separates keys from values in parameters.
-     * @param timeoutMilliseconds Timeout for receiving a complete message.
-     * @param maxCommandLength Maximum length for command names (default 20).
-     * @param maxMessageLength Maximum total message length (default 128).
+     * The message is streamed straight from flash, no RAM copy is made.
+     * 
+     * @param level The message level, selects the message type (e.g. "DEBUG", "ERR").
+     * @param message The message content stored in program memory.
+     * @param identifier Optional identifier for the message.
+     * @param flashIdentifier Optional identifier stored in program memory, used in preference to identifier.
      */
-    SerialCommandManager(Stream* serialPort, MessageReceivedCallback commandReceived, 
-        char terminator = '\n', char commandSeparator = ':', char paramSeparator = ';', 
-		char keyValueSeparator = '=',
-        unsigned long timeoutMilliseconds = 500, 
-        uint8_t maxCommandLength = DefaultMaxCommandLength,
-        uint8_t maxMessageLength = DefaultMaxMessageLength);
+    void sendMessage(LogLevel level, const __FlashStringHelper* message, const char* identifier, const __FlashStringHelper* flashIdentifier);
 
     /**
-     * @brief Destructor for SerialCommandManager.
+     * @brief Writes the message type for a log level followed by ':'.
      */
-    ~SerialCommandManager();
+    void writeLogHeader(LogLevel level);
 
     /**
-     * @brief Registers an array of command handler objects.
+     * @brief Records a message in the log buffer instead of sending it.
      * 
-     * @param handlers Array of pointers to ISerialCommandHandler objects.
-     * @param handlerCount Number of handlers in the array.
+     * @return true if the message was captured, false if it should be sent.
      */
-    void registerHandlers(ISerialCommandHandler** handlers, size_t handlerCount);
+    bool captureLog(LogLevel level, const char* message, bool messageInFlash, const __FlashStringHelper* flashIdentifier);
 
     /**
-     * @brief Reads and processes incoming serial commands.
+     * @brief Gets the rate limit state used for a log level.
+     * 
+     * @return Rate limit for errors or debug/trace messages, nullptr for levels that are not limited.
      */
-    void readCommands();
+    MessageRateLimit* rateLimitFor(LogLevel level);
 
     /**
-     * @brief Checks if the last message reception timed out.
+     * @brief Applies sampling and rate limiting to a message about to be sent.
      * 
-     * @return true if a timeout occurred, false otherwise.
+     * @param level The message level.
+     * @param message The message text, kept for the suppressed summary.
+     * @param messageInFlash true if message points to program memory.
+     * @return true if the message may be sent, false if it was suppressed.
      */
-    bool isTimeout();
+    bool allowMessage(LogLevel level, const char* message, bool messageInFlash);
 
     /**
-     * @brief Gets the parsed command string from the last message.
+     * @brief Sends "<type>:<message> x<count> suppressed" for rate limited message types.
+     */
+    void sendSuppressedSummary();
+
+    /**
+     * @brief Reports an error raised by the library, as text or as ERR:<code> in compact mode.
      * 
-     * @return Pointer to the command string buffer.
+     * @param code The error being reported.
      */
-    const char* getCommand();
+    void sendLibraryError(ErrorCode code);
 
     /**
-     * @brief Gets a parsed key/value argument by index.
+     * @brief Writes a complete command message, shared by the sendCommand() overloads.
      * 
-     * @param index Index of the argument to retrieve.
-     * @return Pointer to the key/value pair at the specified index, or nullptr if invalid.
+     * @param header The command header, in RAM or program memory.
+     * @param headerInFlash true if header points to program memory.
+     * @param message The message content.
+     * @param identifier Optional identifier for the message.
+     * @param params Optional array of key/value parameters.
+     * @param argLength Number of parameters in the array.
      */
-    const StringKeyValue* getArgs(uint8_t index);
+    void writeCommand(const char* header, bool headerInFlash, const char* message, const char* identifier, const StringKeyValue* params, uint8_t argLength);
 
     /**
-     * @brief Gets the number of parsed arguments in the last message.
+     * @brief Writes a complete acknowledgement message, shared by the sendAck() overloads.
+     */
+    void writeAck(const char* correlationId, const char* command, const char* result, const __FlashStringHelper* flashResult, const StringKeyValue* params, uint8_t argLength);
+
+    /**
+     * @brief Writes key/value parameters separated by the parameter separator.
+     */
+    void writeParams(const StringKeyValue* params, uint8_t argLength);
+
+    /**
+     * @brief Reads incoming bytes and dispatches complete messages.
      * 
-     * @return The argument count.
+     * @param maxBytes Maximum number of bytes to read, 0 reads everything available.
      */
-    uint8_t getArgCount();
+    void readIncoming(uint16_t maxBytes);
 
     /**
-     * @brief Gets the raw message string as received.
+     * @brief Moves a correlation id parameter out of the parsed parameters into _correlationId.
+     */
+    void extractCorrelationId();
+
+    /**
+     * @brief Writes a correlation id as a parameter, if there is one.
      * 
-     * @return Pointer to the raw message buffer.
+     * @param correlationId The id, nullptr or empty for none.
+     * @return true if the id was written.
      */
-    const char* getRawMessage();
+    bool writeCorrelationId(const char* correlationId);
 
     /**
-     * @brief Sends a command message over the serial port.
+     * @brief Gets the id replies sent now should echo, see getCorrelationId().
+     */
+    const char* replyCorrelationId() const;
+
+#if SCM_CONCURRENT
+    /**
+     * @brief Sets the id echoed by replies from the calling task, nullptr to use the message being read.
      * 
-     * @param header The command header string.
-     * @param message The message content.
-     * @param identifier Optional identifier for the message.
-     * @param params Optional array of key/value parameters.
-     * @param argLength Number of parameters in the array.
+     * Used by DeferredDispatchHandler while a worker runs a queued command, so its replies echo the
+     * id the command arrived with rather than that of whatever message is being read meanwhile.
      */
-    void sendCommand(const char* header, const char* message, const char* identifier = "", const StringKeyValue* params = nullptr, uint8_t argLength = 0);
+    static void setTaskCorrelationId(const char* correlationId);
+#endif
 
     /**
-     * @brief Sends a debug message over the serial port.
+     * @brief Releases the registry built by registerHandlers(), if any.
+     */
+    void releaseRegistry();
+
+    /**
+     * @brief Starts an outgoing message, deciding whether it can be queued.
      * 
-     * @param message The debug message content.
-     * @param identifier Optional identifier for the message.
+     * @param isDebug true if the message is a debug message.
+     * @param isUrgent true if the message is sent without waiting for the batch deadline (errors and ACKs).
+     * @return false if the message should be discarded without writing anything.
      */
-    void sendDebug(const char* message, const char* identifier = "");
+    bool beginMessage(bool isDebug, bool isUrgent = false);
 
     /**
-     * @brief Sends a debug message over the serial port using Flash string.
-     *
-     * @param message The debug message content stored in program memory.
-     * @param identifier Optional identifier for the message stored in program memory.
+     * @brief Completes an outgoing message started with beginMessage().
+     * 
+     * @param spendsCredit false for CREDIT frames, which do not occupy a slot in the peer's receive buffer.
      */
-    void sendDebug(const __FlashStringHelper* message, const __FlashStringHelper* identifier = nullptr);
+    void endMessage(bool spendsCredit = true);
 
     /**
-     * @brief Sends a debug message over the serial port with Flash string identifier.
-     *
-     * @param message The debug message content.
-     * @param identifier Identifier for the message stored in program memory.
+     * @brief Uses up one of the peer's credits, if any are left.
      */
-    void sendDebug(const char* message, const __FlashStringHelper* identifier);
+    void spendCredit();
 
     /**
-     * @brief Sends an error message over the serial port.
+     * @brief Adds credits granted by the peer, saturating at 0xFFFF.
+     */
+    void addCredits(unsigned long credits);
+
+    /**
+     * @brief Appends bytes to the transmit buffer, applying the overflow policy when full.
+     */
+    void queueBytes(const char* data, size_t length);
+
+    /**
+     * @brief Moves queued bytes to the serial port.
      * 
-     * @param message The error message content.
-     * @param identifier Optional identifier for the message.
+     * @param blocking true to write regardless of availableForWrite(), false to write only what fits.
      */
-    void sendError(const char* message, const char* identifier = "");
+    void drainTx(bool blocking);
 
     /**
-     * @brief Sends an error message over the serial port using Flash string.
-     *
-     * @param message The error message content stored in program memory.
-     * @param identifier Optional identifier for the message stored in program memory.
+     * @brief Sets up the serial port and message format, shared by the constructors.
      */
-    void sendError(const __FlashStringHelper* message, const __FlashStringHelper* identifier = nullptr);
+    void init(Stream* serialPort, MessageReceivedCallback commandReceived, char terminator, char commandSeparator,
+        char paramSeparator, char keyValueSeparator, unsigned long timeoutMilliseconds);
 
+#if SCM_COMMAND_STATS
     /**
-     * @brief Sends an error message over the serial port with Flash string identifier.
+     * @brief Counts the message just dispatched against its command.
+     * 
+     * @param elapsed Time spent dispatching in microseconds.
+     * @param handled true if a handler handled the message.
+     */
+    void recordCommand(uint32_t elapsed, bool handled);
+
+    /**
+     * @brief Writes the bucket counts of a histogram as a comma separated list, trailing empty buckets omitted.
+     * 
+     * @return Characters written, buffer must hold CommandStatsBuckets * 6 characters.
+     */
+    static uint8_t formatHistogram(char* buffer, const uint16_t* histogram);
+#endif
+
+    /**
+     * @brief Measures the parameter key or value that following characters are appended to.
+     */
+    void startField();
+
+    /**
+     * @brief Grants credit to the peer and sends XON/XOFF as the receive buffer fills and drains.
+     */
+    void updateFlowControl();
+
+    /**
+     * @brief Sends XOFF once the receive buffer reaches 3/4 of the flow control window.
      *
-     * @param message The error message content.
-     * @param identifier Identifier for the message stored in program memory.
+     * @param waiting Bytes waiting in the receive buffer.
      */
-    void sendError(const char* message, const __FlashStringHelper* identifier);
-};
+    void checkXoff(int waiting);
+
+    /**
+     * @brief Sends CREDIT:<credits>, CREDIT:window=<credits> when advertising, or CREDIT to request credit.
+     * 
+     * @return false if the message was dropped by the transmit buffer.
+     */
+    bool sendCredit(uint16_t credits, bool advertise);
+
+    /**
+     * @brief Sends the current batch, continuing on later polls if the port cannot take it all.
+     */
+    void flushBatch();
+
+    /**
+     * @brief Writes the optional ": (identifier)" suffix used by outgoing messages.
+     */
+    void writeIdentifier(const char* identifier, const __FlashStringHelper* flashIdentifier);
+
+    /**
+     * @brief Writes a block of bytes to the serial port.
+     */
+    void writeBytes(const char* data, size_t length);
+
+    /**
+     * @brief Writes a null terminated string to the serial port.
+     */
+    void writeText(const char* text);
+
+    /**
+     * @brief Writes a single character to the serial port.
+     */
+    void writeChar(char c);
+
+    /**
+     * @brief Writes a null terminated string stored in program memory to the serial port.
+     * 
+     * The string is read in small chunks, no full size RAM copy is made.
+     */
+    void writeFlash(const __FlashStringHelper* text);
+
+    /**
+     * @brief Sends "header:<formatted text>" using the built in formatter.
+     * 
+     * @param header The message header.
+     * @param format Format string in RAM or program memory.
+     * @param formatInFlash true if format points to program memory.
+     * @param level The message level, decides whether it is sent, captured or dropped.
+     * @param args Arguments referenced by the format string.
+     */
+    void sendFormatted(const char* header, const char* format, bool formatInFlash, LogLevel level, va_list args);
+
+    /**
+     * @brief Formats text directly to the output without an intermediate buffer.
+     * 
+     * @return The last character written, or '\0' if nothing was written.
+     */
+    char writeFormatted(const char* format, bool formatInFlash, va_list args);
+
+public:
+    /**
+     * @brief Constructs a SerialCommandManager instance.
+     * 
+     * @param serialPort Pointer to the Stream object for serial communication.
+     * @param commandReceived Callback function for received commands.
+     * @param terminator Character that terminates a command message.
+     * @param commandSeparator Character that separates command from parameters.
+     * @param paramSeparator Character that separates parameters.
+	 * @param keyValueSeparator Character that separates keys from values in parameters.
+     * @param timeoutMilliseconds Timeout for receiving a complete message.
+     * @param maxCommandLength Maximum length for command names (default 20).
+     * @param maxMessageLength Maximum total message length (default 128).
+     */
+    SerialCommandManager(Stream* serialPort, MessageReceivedCallback commandReceived, 
+        char terminator = '\n', char commandSeparator = ':', char paramSeparator = ';', 
+		char keyValueSeparator = '=',
+        unsigned long timeoutMilliseconds = 500, 
+        uint8_t maxCommandLength = DefaultMaxCommandLength,
+        uint8_t maxMessageLength = DefaultMaxMessageLength)
+#if SCM_NO_HEAP
+        = delete
+#endif
+        ;
+
+    /**
+     * @brief Constructs a SerialCommandManager that never allocates, using caller provided storage.
+     * 
+     * The command and message buffers are carved from storage and registerHandlers() copies into handlerSlots.
+     * Combine with the setTxBuffer() and setLogBuffer() storage overloads, or setRegistry(), for a
+     * manager that never calls new.
+     * 
+     * Example:
+     * `
+     * static uint8_t storage[SerialCommandManager::storageSize()];
+     * static ISerialCommandHandler* handlerSlots[4];
+     * SerialCommandManager commandMgr(&Serial, nullptr, storage, sizeof(storage), handlerSlots, 4);
+     * `
+     * 
+     * @param serialPort Pointer to the Stream object for serial communication.
+     * @param commandReceived Callback function for received commands.
+     * @param storage Buffer of storageSize(maxCommandLength, maxMessageLength) bytes, must outlive the
+     *        manager. A smaller buffer reduces the maximum lengths to fit, below MinimumStorageSize
+     *        bytes (or nullptr) no input is read and the manager only sends.
+     * @param storageSize Size of storage in bytes.
+     * @param handlerSlots Array registerHandlers() copies handlers into, nullptr to use setRegistry() only.
+     * @param handlerSlotCount Number of entries in handlerSlots, further handlers are not registered.
+     * @param terminator Character that terminates a command message.
+     * @param commandSeparator Character that separates command from parameters.
+     * @param paramSeparator Character that separates parameters.
+     * @param keyValueSeparator Character that separates keys from values in parameters.
+     * @param timeoutMilliseconds Timeout for receiving a complete message.
+     * @param maxCommandLength Maximum length for command names (default 20).
+     * @param maxMessageLength Maximum total message length (default 128).
+     */
+    SerialCommandManager(Stream* serialPort, MessageReceivedCallback commandReceived,
+        uint8_t* storage, size_t storageSize,
+        ISerialCommandHandler** handlerSlots = nullptr, size_t handlerSlotCount = 0,
+        char terminator = '\n', char commandSeparator = ':', char paramSeparator = ';',
+        char keyValueSeparator = '=',
+        unsigned long timeoutMilliseconds = 500,
+        uint8_t maxCommandLength = DefaultMaxCommandLength,
+        uint8_t maxMessageLength = DefaultMaxMessageLength);
+
+    /**
+     * @brief Gets the storage needed by the caller storage constructor.
+     * 
+     * @param maxCommandLength Maximum length for command names.
+     * @param maxMessageLength Maximum total message length.
+     * @return Size in bytes.
+     */
+    static constexpr size_t storageSize(uint8_t maxCommandLength = DefaultMaxCommandLength,
+        uint8_t maxMessageLength = DefaultMaxMessageLength)
+    {
+        return (size_t)maxCommandLength + 1 + (size_t)maxMessageLength + 1;
+    }
+
+    /**
+     * @brief Destructor for SerialCommandManager.
+     */
+    ~SerialCommandManager();
+
+    /**
+     * @brief Registers an array of command handler objects.
+     * 
+     * The array is copied, into the handler slots when constructed with caller storage, otherwise
+     * into a heap allocation (nothing is registered when SCM_NO_HEAP is set and no slots were
+     * provided). Use setRegistry() to share one handler list between managers.
+     * 
+     * @param handlers Array of pointers to ISerialCommandHandler objects.
+     * @param handlerCount Number of handlers in the array.
+     */
+    void registerHandlers(ISerialCommandHandler** handlers, size_t handlerCount);
+
+    /**
+     * @brief Uses a shared registry of command handlers, replacing any registered handlers.
+     * 
+     * The registry is not copied and must outlive the manager. The built in DEBUG and LOG
+     * handlers are always available and are not part of the registry.
+     * 
+     * @param registry The handlers to dispatch commands to, nullptr for none.
+     */
+    void setRegistry(const SerialCommandRegistry* registry);
+
+    /**
+     * @brief Gets the registry commands are dispatched to.
+     * 
+     * @return The registry, nullptr if no handlers are registered.
+     */
+    const SerialCommandRegistry* getRegistry();
+
+    /**
+     * @brief Reads and processes incoming serial commands.
+     * 
+     * Also calls poll() so queued output is sent.
+     */
+    void readCommands();
+
+    /**
+     * @brief Reads and processes at most maxBytes of incoming data.
+     * 
+     * Limits the time spent servicing a busy port, the rest is read on the next call.
+     * Also calls poll() so queued output is sent.
+     * 
+     * @param maxBytes Maximum number of bytes to read, 0 reads everything available.
+     */
+    void readCommands(uint16_t maxBytes);
+
+    /**
+     * @brief Performs background work without reading input.
+     * 
+     * Sends as much queued output as the serial port can accept without blocking
+     * (see setTxBuffer()). Call from loop() when readCommands() is not called often enough.
+     */
+    void poll();
+
+    /**
+     * @brief Enables or disables the transmit buffer.
+     * 
+     * When enabled, outgoing messages are queued in a ring buffer and written to the
+     * serial port only as fast as availableForWrite() allows, so sending never waits
+     * for the wire unless the overflow policy requires it. The Stream must report
+     * availableForWrite() for queued output to be sent.
+     * 
+     * Any output already queued is written (blocking) before the buffer is changed, or discarded
+     * while the peer has sent XOFF.
+     * 
+     * @param size Size of the buffer in bytes, 0 disables buffering.
+     * @param policy Action taken when a message does not fit in the buffer.
+     * @return true if the buffer was configured, false if the allocation failed or a Report buffer is
+     *         smaller than TxOverflowReportLength, which leaves the current buffer unchanged.
+     */
+    bool setTxBuffer(uint16_t size, TxOverflowPolicy policy = TxOverflowPolicy::DropDebug)
+#if SCM_NO_HEAP
+        = delete
+#endif
+        ;
+
+    /**
+     * @brief Enables the transmit buffer using caller provided storage, see setTxBuffer(uint16_t, TxOverflowPolicy).
+     * 
+     * @param buffer Buffer for queued output, must outlive the manager, nullptr disables buffering.
+     * @param size Size of the buffer in bytes.
+     * @param policy Action taken when a message does not fit in the buffer.
+     * @return true, or false if a Report buffer is smaller than TxOverflowReportLength, which leaves the
+     *         current buffer unchanged.
+     */
+    bool setTxBuffer(char* buffer, uint16_t size, TxOverflowPolicy policy = TxOverflowPolicy::DropDebug);
+
+    /**
+     * @brief Batches queued output to reduce the number of writes (packets on USB-CDC and BLE bridges).
+     * 
+     * Messages collect in the transmit buffer and are sent together when the buffer is 3/4 full,
+     * when the oldest message has waited deadlineMilliseconds, or when flush() is called.
+     * Errors and ACKs are urgent, they send the batch ahead of them immediately.
+     * Requires setTxBuffer().
+     * 
+     * @param deadlineMilliseconds Maximum time a message is held, 0 disables batching.
+     * @return false if no transmit buffer is configured.
+     */
+    bool setBatching(uint16_t deadlineMilliseconds);
+
+    /**
+     * @brief Sends all queued output without waiting for the batch deadline.
+     * 
+     * Writes what the serial port can accept now, the remainder is sent by readCommands() / poll().
+     */
+    void flush();
+
+    /**
+     * @brief Enables flow control so a pipelining sender never overruns the receive buffer.
+     * 
+     * Credit: the receiver advertises window free message slots with CREDIT:window=<n>, sent when
+     * enabled and whenever the peer asks with CREDIT. Each message read frees a slot, freed slots are
+     * granted back with CREDIT:<n>, coalesced while further input is waiting. The sender spends one
+     * credit per message and only sends while canSend() is true. A sender with a window of 0 asks
+     * for credit when enabled, do so while nothing is in flight. Only the first window advertised
+     * after asking is used, so a stale advertisement already on the wire cannot add credit twice.
+     * 
+     * XonXoff: the receiver sends XOFF (0x13) once 3/4 of its receive buffer is waiting to be read
+     * and XON (0x11) once it falls to 1/4, window is the size of the serial receive buffer. XON/XOFF
+     * received are removed from the input, XOFF holds queued output and clears canSend().
+     * 
+     * Both sides enable the same mode, grants and XON/XOFF are sent by readCommands() / poll().
+     * 
+     * @param mode Flow control mode.
+     * @param window Receive slots (Credit) or receive buffer size in bytes (XonXoff), 0 to only send.
+     */
+    void setFlowControl(FlowControl mode, uint16_t window = 0);
+
+    /**
+     * @brief Gets the flow control mode.
+     */
+    FlowControl getFlowControl();
+
+    /**
+     * @brief Checks whether flow control allows another message to be sent to the peer.
+     * 
+     * @return false while the peer has granted no credit or has sent XOFF.
+     */
+    bool canSend();
+
+    /**
+     * @brief Gets the number of messages the peer can currently accept (Credit flow control).
+     */
+    uint16_t getCredits();
+
+#if SCM_COMMAND_STATS
+    /**
+     * @brief Gets the counters for a command.
+     * 
+     * @param command The command, "*" for commands no handler lists.
+     * @return The counters, nullptr if the command has not been received.
+     */
+    const CommandStats* getCommandStats(const char* command);
+
+    /**
+     * @brief Gets the counters by position, commands are added in the order first received.
+     * 
+     * @param index Position of the entry, less than getCommandStatsCount().
+     * @return The counters, nullptr if index is out of range.
+     */
+    const CommandStats* getCommandStatsAt(uint8_t index);
+
+    /**
+     * @brief Gets the number of commands with counters, at most SCM_COMMAND_STATS.
+     */
+    uint8_t getCommandStatsCount();
+
+    /**
+     * @brief Gets the histogram of time from the first byte of a message to its terminator.
+     * 
+     * @return CommandStatsBuckets counts, bucket i counts messages taking 2^i to 2^(i+1)-1 microseconds.
+     */
+    const uint16_t* getParseHistogram();
+
+    /**
+     * @brief Clears all command counters and the parse histogram.
+     */
+    void resetCommandStats();
+
+    /**
+     * @brief Sends the counters, one message per command followed by the parse histogram.
+     * 
+     * STAT:<command>=<received>;ok=<handled>;fail=<failed>;cb=<fell through>;us=<bucket counts>
+     * STAT:parse=<messages>;us=<bucket counts>
+     * 
+     * Bucket counts are comma separated from bucket 0, trailing empty buckets are omitted.
+     */
+    void sendCommandStats();
+#endif
+
+    /**
+     * @brief Gets the number of bytes waiting in the transmit buffer.
+     * 
+     * @return Queued byte count, 0 when the transmit buffer is disabled.
+     */
+    uint16_t getTxPending();
+
+    /**
+     * @brief Gets the total number of messages dropped because the transmit buffer was full.
+     * 
+     * @return Dropped message count.
+     */
+    uint16_t getTxDropped();
+
+    /**
+     * @brief Checks if the last message reception timed out.
+     * 
+     * @return true if a timeout occurred, false otherwise.
+     */
+    bool isTimeout();
+
+    /**
+     * @brief Checks if a message has started arriving and its terminator has not.
+     *
+     * The timeout for such a message is checked by readCommands(), so an event loop that only
+     * reads when data arrives must still call it periodically while this is true.
+     *
+     * @return true while a message is partially received.
+     */
+    bool isReceiving() const;
+
+    /**
+     * @brief Gets the parsed command string from the last message.
+     * 
+     * @return Pointer to the command string buffer.
+     */
+    const char* getCommand();
+
+    /**
+     * @brief Gets a parsed key/value argument by index.
+     * 
+     * @param index Index of the argument to retrieve.
+     * @return Pointer to the key/value pair at the specified index, or nullptr if invalid.
+     */
+    const StringKeyValue* getArgs(uint8_t index);
+
+    /**
+     * @brief Gets the number of parsed arguments in the last message.
+     * 
+     * @return The argument count.
+     */
+    uint8_t getArgCount();
+
+    /**
+     * @brief Gets the correlation id of the message being handled.
+     * 
+     * A host pipelining requests adds the reserved parameter #=<id>, e.g. LED:#=42;pin=13. The
+     * parameter is removed from the arguments passed to handlers and is echoed automatically by
+     * sendAck() (and so BaseCommandHandler::sendAckOk/sendAckErr) while the message is handled,
+     * e.g. ACK:LED=ok:#=42. On a DeferredDispatchHandler worker it is the id of the queued command
+     * being run.
+     * 
+     * @return The id, empty if the message has none or no message is being handled.
+     */
+    const char* getCorrelationId();
+
+    /**
+     * @brief Gets the raw message string as received.
+     * 
+     * @return Pointer to the raw message buffer.
+     */
+    const char* getRawMessage();
+
+    /**
+     * @brief Sends a command message over the serial port.
+     * 
+     * @param header The command header string.
+     * @param message The message content.
+     * @param identifier Optional identifier for the message.
+     * @param params Optional array of key/value parameters.
+     * @param argLength Number of parameters in the array.
+     */
+    void sendCommand(const char* header, const char* message, const char* identifier = "", const StringKeyValue* params = nullptr, uint8_t argLength = 0);
+
+    /**
+     * @brief Sends a command message over the serial port using a Flash string header.
+     * 
+     * @param header The command header string stored in program memory.
+     * @param message The message content.
+     * @param identifier Optional identifier for the message.
+     * @param params Optional array of key/value parameters.
+     * @param argLength Number of parameters in the array.
+     */
+    void sendCommand(const __FlashStringHelper* header, const char* message, const char* identifier = "", const StringKeyValue* params = nullptr, uint8_t argLength = 0);
+
+    /**
+     * @brief Sends an acknowledgement in the form ACK:<command>=<result>[:<params>].
+     * 
+     * The message is written in a single pass, no intermediate buffer is used.
+     * 
+     * @param command The command being acknowledged.
+     * @param result The result text, e.g. "ok" or an error description.
+     * @param params Optional array of key/value parameters.
+     * @param argLength Number of parameters in the array.
+     */
+    void sendAck(const char* command, const char* result, const StringKeyValue* params = nullptr, uint8_t argLength = 0);
+
+    /**
+     * @brief Sends an acknowledgement with a result stored in program memory.
+     * 
+     * @param command The command being acknowledged.
+     * @param result The result text stored in program memory.
+     * @param params Optional array of key/value parameters.
+     * @param argLength Number of parameters in the array.
+     */
+    void sendAck(const char* command, const __FlashStringHelper* result, const StringKeyValue* params = nullptr, uint8_t argLength = 0);
+
+    /**
+     * @brief Sends an acknowledgement echoing the given correlation id rather than the current one.
+     * 
+     * For replies sent after the handler has returned, e.g. when a long operation completes, keep a
+     * copy of getCorrelationId() from the handler and pass it here.
+     * 
+     * @param correlationId The id to echo, nullptr or empty for none.
+     * @param command The command being acknowledged.
+     * @param result The result text, e.g. "ok" or an error description.
+     * @param params Optional array of key/value parameters.
+     * @param argLength Number of parameters in the array.
+     */
+    void sendCorrelatedAck(const char* correlationId, const char* command, const char* result, const StringKeyValue* params = nullptr, uint8_t argLength = 0);
+
+    /**
+     * @brief Sends a command message built from a format string.
+     * 
+     * Text is formatted directly to the serial port (or transmit buffer), no intermediate
+     * buffer is used. Supported conversions are a small subset of printf:
+     * %d %i %u %x %X (with optional l for long), %f (fixed-point, default 6 decimals),
+     * %c, %s, %S (string stored in program memory, e.g. F("text")) and %%.
+     * Zero padding, width and precision are supported, e.g. %04u, %.2f or %.8s.
+     * 
+     * @param header The command header string.
+     * @param format The format string.
+     */
+    void sendCommandf(const char* header, const char* format, ...);
+
+    /**
+     * @brief Sends a command message built from a format string stored in program memory.
+     * 
+     * @param header The command header string.
+     * @param format The format string stored in program memory.
+     */
+    void sendCommandf(const char* header, const __FlashStringHelper* format, ...);
+
+    /**
+     * @brief Sends a formatted debug message, see sendCommandf() for supported conversions.
+     * 
+     * Nothing is formatted when debug mode is off.
+     * 
+     * @param format The format string.
+     */
+    void sendDebugf(const char* format, ...);
+
+    /**
+     * @brief Sends a formatted debug message using a format string stored in program memory.
+     * 
+     * @param format The format string stored in program memory.
+     */
+    void sendDebugf(const __FlashStringHelper* format, ...);
+
+    /**
+     * @brief Sends a formatted error message, see sendCommandf() for supported conversions.
+     * 
+     * @param format The format string.
+     */
+    void sendErrorf(const char* format, ...);
+
+    /**
+     * @brief Sends a formatted error message using a format string stored in program memory.
+     * 
+     * @param format The format string stored in program memory.
+     */
+    void sendErrorf(const __FlashStringHelper* format, ...);
+
+    /**
+     * @brief Checks whether a message of the given level and module would be sent.
+     * 
+     * Debug and trace messages also require debug mode to be on (see the DEBUG command)
+     * or the log buffer to be enabled.
+     * 
+     * @param level The message level.
+     * @param module The log module, 0 to LogModuleCount - 1.
+     * @return true if the message would be sent.
+     */
+    bool isLogEnabled(LogLevel level, uint8_t module = LogModuleDefault) const {
+        return module < LogModuleCount && level != LogLevel::None &&
+            (uint8_t)level <= _logLevels[module] && (level < LogLevel::Debug || _isDebug || (_logRecords && level >= _logCaptureLevel));
+    }
+
+    /**
+     * @brief Sets the runtime log level for a module.
+     * 
+     * Levels above SCM_LOG_LEVEL are compiled out and cannot be enabled at runtime, a higher level
+     * is lowered to SCM_LOG_LEVEL.
+     * 
+     * @param module The log module, 0 to LogModuleCount - 1.
+     * @param level The highest level sent for the module, LogLevel::None silences the module.
+     */
+    void setLogLevel(uint8_t module, LogLevel level);
+
+    /**
+     * @brief Gets the runtime log level for a module.
+     * 
+     * @param module The log module, 0 to LogModuleCount - 1.
+     * @return The module log level, LogLevel::None for an invalid module.
+     */
+    LogLevel getLogLevel(uint8_t module);
+
+    /**
+     * @brief Sends a log message if enabled for the level and module.
+     * 
+     * Prefer the SCM_LOG_* macros which remove calls above SCM_LOG_LEVEL at compile time.
+     * 
+     * @param level The message level.
+     * @param module The log module.
+     * @param message The message content.
+     * @param identifier Optional identifier for the message.
+     */
+    void sendLog(LogLevel level, uint8_t module, const char* message, const char* identifier = "");
+
+    /**
+     * @brief Sends a log message stored in program memory if enabled for the level and module.
+     * 
+     * @param level The message level.
+     * @param module The log module.
+     * @param message The message content stored in program memory.
+     * @param identifier Optional identifier for the message stored in program memory.
+     */
+    void sendLog(LogLevel level, uint8_t module, const __FlashStringHelper* message, const __FlashStringHelper* identifier = nullptr);
+
+    /**
+     * @brief Sends a log message with a Flash string identifier if enabled for the level and module.
+     * 
+     * @param level The message level.
+     * @param module The log module.
+     * @param message The message content.
+     * @param identifier Identifier for the message stored in program memory.
+     */
+    void sendLog(LogLevel level, uint8_t module, const char* message, const __FlashStringHelper* identifier);
+
+    /**
+     * @brief Enables or disables the in-RAM log buffer.
+     * 
+     * When enabled, messages at captureLevel or less severe (e.g. debug and trace) are stored as
+     * compact records instead of being sent, whether or not debug mode is on. The most recent
+     * records are kept and can be sent on demand with dumpLogBuffer() or the LOG command.
+     * 
+     * Each record holds a timestamp, the level and either a reference to a flash message
+     * or a copy of the first LogRecordTextLength characters of a RAM message. Formatted
+     * messages are recorded as their format string.
+     * 
+     * @param records Number of records to keep, 0 disables the buffer.
+     * @param captureLevel Most severe level captured, default LogLevel::Debug.
+     * @return true if the buffer was configured, false if the allocation failed.
+     */
+    bool setLogBuffer(uint8_t records, LogLevel captureLevel = LogLevel::Debug)
+#if SCM_NO_HEAP
+        = delete
+#endif
+        ;
+
+    /**
+     * @brief Enables the log buffer using caller provided storage, see setLogBuffer(uint8_t, LogLevel).
+     * 
+     * Example:
+     * `
+     * alignas(void*) static uint8_t logStorage[SerialCommandManager::logBufferSize(16)];
+     * commandMgr.setLogBuffer(logStorage, sizeof(logStorage));
+     * `
+     * 
+     * @param storage Pointer aligned buffer for the records, must outlive the manager, nullptr disables the buffer.
+     * @param storageSize Size of storage in bytes, see logBufferSize().
+     * @param captureLevel Most severe level captured, default LogLevel::Debug.
+     * @return true, no allocation is needed.
+     */
+    bool setLogBuffer(void* storage, size_t storageSize, LogLevel captureLevel = LogLevel::Debug);
+
+    /**
+     * @brief Gets the storage needed by setLogBuffer(void*, size_t, LogLevel) for a number of records.
+     * 
+     * @param records Number of records to keep.
+     * @return Size in bytes.
+     */
+    static constexpr size_t logBufferSize(uint8_t records)
+    {
+        return records * sizeof(LogRecord);
+    }
+
+    /**
+     * @brief Gets the number of records the log buffer can hold.
+     * 
+     * @return Log buffer size, 0 when disabled.
+     */
+    uint8_t getLogBufferSize();
+
+    /**
+     * @brief Gets the number of records currently held in the log buffer.
+     * 
+     * @return Record count.
+     */
+    uint8_t getLogBufferCount();
+
+    /**
+     * @brief Removes all records from the log buffer.
+     */
+    void clearLogBuffer();
+
+    /**
+     * @brief Sends the log buffer, oldest first, as LOG:t=<ms>;l=<E|W|I|D|T>;m=<message>[;id=<identifier>].
+     */
+    void dumpLogBuffer();
+
+    /**
+     * @brief Limits how many messages of a type are sent using a token bucket.
+     * 
+     * Up to burst messages can be sent at once, after which one message is allowed every
+     * refillMilliseconds. Suppressed messages are counted and reported periodically from
+     * poll() as "<type>:<message> x<count> suppressed".
+     * 
+     * @param level LogLevel::Error for errors, LogLevel::Debug for debug and trace messages.
+     * @param burst Maximum number of messages sent back to back, 0 disables rate limiting.
+     * @param refillMilliseconds Time taken to allow one more message.
+     */
+    void setRateLimit(LogLevel level, uint8_t burst, uint16_t refillMilliseconds);
+
+    /**
+     * @brief Sends only one in every N messages of a type.
+     * 
+     * @param level LogLevel::Error for errors, LogLevel::Debug for debug and trace messages.
+     * @param everyN Send the first of every N messages, 0 or 1 sends every message.
+     */
+    void setSampling(LogLevel level, uint8_t everyN);
+
+    /**
+     * @brief Sets the minimum time between suppressed message summaries.
+     * 
+     * @param milliseconds Summary interval, default 1000.
+     */
+    void setSuppressedSummaryInterval(uint16_t milliseconds);
+
+    /**
+     * @brief Gets the number of messages suppressed since the last summary.
+     * 
+     * @param level LogLevel::Error for errors, LogLevel::Debug for debug and trace messages.
+     * @return Suppressed message count.
+     */
+    uint16_t getSuppressedCount(LogLevel level);
+
+    /**
+     * @brief Sends library errors as ERR:<code> instead of ERR:<text>: (SerialCommandManager).
+     * 
+     * Saves wire bytes on slow links, the host decodes the code using the ErrorCode catalogue.
+     * Always enabled when compiled with SCM_ERROR_TEXT 0.
+     * 
+     * @param compact true to send numeric error codes.
+     */
+    void setCompactErrors(bool compact);
+
+    /**
+     * @brief Gets whether library errors are sent as numeric codes.
+     * 
+     * @return true if compact errors are in use.
+     */
+    bool getCompactErrors();
+
+    /**
+     * @brief Gets the description of a library error.
+     * 
+     * @param code The error code.
+     * @return The description in program memory, nullptr if unknown or compiled with SCM_ERROR_TEXT 0.
+     */
+    static const __FlashStringHelper* getErrorText(ErrorCode code);
+
+    /**
+     * @brief Starts a message whose parameters are written directly to the output.
+     * 
+     * Returns a builder that serializes each key/value as it is added, with no intermediate
+     * StringKeyValue, e.g. sender->reply("ACK").kv("pin", 13).kv("state", "ON").send();
+     * produces "ACK:pin=13;state=ON". Nothing else should be sent until send() is called.
+     * 
+     * @param header The message header.
+     * @param message Optional message written after the header.
+     * @return Builder for adding parameters.
+     */
+    ParamBuilder reply(const char* header, const char* message = nullptr);
+
+    /**
+     * @brief Starts a message with a Flash string header whose parameters are written directly to the output.
+     * 
+     * @param header The message header stored in program memory.
+     * @param message Optional message written after the header.
+     * @return Builder for adding parameters.
+     */
+    ParamBuilder reply(const __FlashStringHelper* header, const char* message = nullptr);
+
+    /**
+     * @brief Starts an acknowledgement, ACK:<command>=<result>, whose parameters are written directly to the output.
+     * 
+     * @param command The command being acknowledged.
+     * @param result The result text stored in program memory, e.g. F("ok").
+     * @return Builder for adding parameters.
+     */
+    ParamBuilder replyAck(const char* command, const __FlashStringHelper* result);
+
+    /**
+     * @brief Sends a debug message over the serial port.
+     * 
+     * @param message The debug message content.
+     * @param identifier Optional identifier for the message.
+     */
+    void sendDebug(const char* message, const char* identifier = "");
+
+    /**
+     * @brief Sends a debug message over the serial port using Flash string.
+     *
+     * @param message The debug message content stored in program memory.
+     * @param identifier Optional identifier for the message stored in program memory.
+     */
+    void sendDebug(const __FlashStringHelper* message, const __FlashStringHelper* identifier = nullptr);
+
+    /**
+     * @brief Sends a debug message over the serial port with Flash string identifier.
+     *
+     * @param message The debug message content.
+     * @param identifier Identifier for the message stored in program memory.
+     */
+    void sendDebug(const char* message, const __FlashStringHelper* identifier);
+
+    /**
+     * @brief Sends an error message over the serial port.
+     * 
+     * @param message The error message content.
+     * @param identifier Optional identifier for the message.
+     */
+    void sendError(const char* message, const char* identifier = "");
+
+    /**
+     * @brief Sends an error message over the serial port using Flash string.
+     *
+     * @param message The error message content stored in program memory.
+     * @param identifier Optional identifier for the message stored in program memory.
+     */
+    void sendError(const __FlashStringHelper* message, const __FlashStringHelper* identifier = nullptr);
+
+    /**
+     * @brief Sends an error message over the serial port with Flash string identifier.
+     *
+     * @param message The error message content.
+     * @param identifier Identifier for the message stored in program memory.
+     */
+    void sendError(const char* message, const __FlashStringHelper* identifier);
+};
+
+/**
+ * @brief Writes a message and its key/value parameters straight to the serial port (or transmit buffer).
+ * 
+ * Created by SerialCommandManager::reply(). Each kv() call formats its value directly to the
+ * output, integers use a fast digit routine and no StringKeyValue is built. The message is
+ * completed by send(), or automatically when the builder goes out of scope.
+ */
+class ParamBuilder
+{
+    friend class SerialCommandManager;
+private:
+    SerialCommandManager* _manager;     // nullptr once sent or if the message was discarded
+    bool _hasParams;
+
+    ParamBuilder(SerialCommandManager* manager);
+
+    /**
+     * @brief Writes the separator and key that start a parameter.
+     * 
+     * @return false if the message is no longer active.
+     */
+    bool beginParam(const char* key);
+
+public:
+    ParamBuilder(ParamBuilder&& other);
+    ParamBuilder(const ParamBuilder&) = delete;
+    ParamBuilder& operator=(const ParamBuilder&) = delete;
+
+    /**
+     * @brief Completes the message if send() has not been called.
+     */
+    ~ParamBuilder();
+
+    /**
+     * @brief Adds a parameter with a string value.
+     */
+    ParamBuilder& kv(const char* key, const char* value);
+
+    /**
+     * @brief Adds a parameter with a value stored in program memory.
+     */
+    ParamBuilder& kv(const char* key, const __FlashStringHelper* value);
+
+    /**
+     * @brief Adds a parameter with a signed integer value.
+     */
+    ParamBuilder& kv(const char* key, int value);
+
+    /**
+     * @brief Adds a parameter with an unsigned integer value.
+     */
+    ParamBuilder& kv(const char* key, unsigned int value);
+
+    /**
+     * @brief Adds a parameter with a signed long value.
+     */
+    ParamBuilder& kv(const char* key, long value);
+
+    /**
+     * @brief Adds a parameter with an unsigned long value.
+     */
+    ParamBuilder& kv(const char* key, unsigned long value);
+
+    /**
+     * @brief Adds a parameter with a fixed-point value.
+     * 
+     * @param key The parameter key.
+     * @param value The value to write.
+     * @param decimals Number of decimal places, default 2.
+     */
+    ParamBuilder& kv(const char* key, double value, uint8_t decimals = 2);
+
+    /**
+     * @brief Writes the terminator and completes the message.
+     */
+    void send();
+};
+
+/**
+ * Logging macros, e.g. SCM_LOG_DEBUG(&commandMgr, LogModuleDefault, F("Motor stopped"), F("Motor"));
+ * 
+ * Calls above SCM_LOG_LEVEL expand to nothing so neither the call nor its arguments reach the binary.
+ * Enabled calls check the runtime level of the module before any arguments are evaluated.
+ */
+#define SCM_LOG_AT(manager, level, module, ...) \
+    do { if ((manager)->isLogEnabled(level, module)) (manager)->sendLog(level, module, __VA_ARGS__); } while (0)
+
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_ERROR
+ #define SCM_LOG_ERROR(manager, module, ...) SCM_LOG_AT(manager, LogLevel::Error, module, __VA_ARGS__)
+#else
+ #define SCM_LOG_ERROR(manager, module, ...) do { } while (0)
+#endif
+
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_WARN
+ #define SCM_LOG_WARN(manager, module, ...) SCM_LOG_AT(manager, LogLevel::Warn, module, __VA_ARGS__)
+#else
+ #define SCM_LOG_WARN(manager, module, ...) do { } while (0)
+#endif
+
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_INFO
+ #define SCM_LOG_INFO(manager, module, ...) SCM_LOG_AT(manager, LogLevel::Info, module, __VA_ARGS__)
+#else
+ #define SCM_LOG_INFO(manager, module, ...) do { } while (0)
+#endif
+
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_DEBUG
+ #define SCM_LOG_DEBUG(manager, module, ...) SCM_LOG_AT(manager, LogLevel::Debug, module, __VA_ARGS__)
+#else
+ #define SCM_LOG_DEBUG(manager, module, ...) do { } while (0)
+#endif
+
+#if SCM_LOG_LEVEL >= SCM_LOG_LEVEL_TRACE
+ #define SCM_LOG_TRACE(manager, module, ...) SCM_LOG_AT(manager, LogLevel::Trace, module, __VA_ARGS__)
+#else
+ #define SCM_LOG_TRACE(manager, module, ...) do { } while (0)
+#endif
 
 #endif
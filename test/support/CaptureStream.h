@@ -0,0 +1,28 @@
+#pragma once
+#include <Arduino.h>
+#include <string>
+
+// ============================================================================
+// Test Stream shared by the test suites, reads from input and captures everything written
+// ============================================================================
+
+class CaptureStream : public Stream {
+public:
+    std::string input;
+    std::string output;
+    size_t readPos = 0;
+    int writeRoom = 1024;       // reported by availableForWrite(), reduced by each write
+    int writeCount = 0;         // number of write calls
+
+    int available() override { return (int)(input.size() - readPos); }
+    int read() override { return readPos < input.size() ? (uint8_t)input[readPos++] : -1; }
+    int peek() override { return readPos < input.size() ? (uint8_t)input[readPos] : -1; }
+    int availableForWrite() override { return writeRoom; }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        output.append(reinterpret_cast<const char*>(buffer), size);
+        writeCount++;
+        writeRoom = writeRoom > (int)size ? writeRoom - (int)size : 0;
+        return size;
+    }
+};
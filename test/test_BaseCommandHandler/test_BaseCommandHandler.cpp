@@ -1,8 +1,10 @@
 #include <gtest/gtest.h>
 #include <ArduinoFake.h>
 #include <string.h>
+#include <string>
 #include "BaseCommandHandler.h"
 #include "SerialCommandManager.h"
+#include "../support/CaptureStream.h"
 
 // Concrete handler for testing makeParam methods
 class TestCommandHandler : public BaseCommandHandler {
@@ -20,6 +22,9 @@ public:
 
     // Expose protected methods for testing
     using BaseCommandHandler::makeParam;
+    using BaseCommandHandler::sendAckOk;
+    using BaseCommandHandler::sendAckErr;
+    using BaseCommandHandler::ackOk;
 };
 
 class BaseCommandHandlerTest : public ::testing::Test {
@@ -254,6 +259,114 @@ TEST_F(BaseCommandHandlerTest, MakeParam_VeryLongKeyWithSpecialChars_TruncatesAn
     EXPECT_EQ(strlen(param.key), DefaultMaxParamKeyLength);
 }
 
+// ============================================================================
+// ACK Tests
+// ============================================================================
+
+class BaseCommandHandlerAckTest : public BaseCommandHandlerTest {
+protected:
+    void SetUp() override {
+        BaseCommandHandlerTest::SetUp();
+        manager = new SerialCommandManager(&stream, nullptr);
+    }
+
+    void TearDown() override {
+        delete manager;
+        BaseCommandHandlerTest::TearDown();
+    }
+
+    CaptureStream stream;
+    SerialCommandManager* manager;
+};
+
+TEST_F(BaseCommandHandlerAckTest, SendAckErr_FlashError_StreamedFromFlash) {
+    handler->sendAckErr(manager, "MOVE", F("speed out of range"));
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=speed out of range\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, SendAckErr_FlashErrorWithParam_AppendsParam) {
+    StringKeyValue param = handler->makeParam("speed", 300);
+
+    handler->sendAckErr(manager, "MOVE", F("range"), &param);
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=range:speed=300\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, SendAckErr_NullFlashError_UsesDefault) {
+    handler->sendAckErr(manager, "MOVE", static_cast<const __FlashStringHelper*>(nullptr));
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=error\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, SendAckOk_NoParams_WritesAck) {
+    handler->sendAckOk(manager, "MOVE");
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=ok\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, SendAckOk_WithParam_AppendsParam) {
+    StringKeyValue param = handler->makeParam("pin", 13);
+
+    handler->sendAckOk(manager, "GPIO", &param);
+
+    EXPECT_EQ(stream.output, "ACK:GPIO=ok:pin=13\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, SendAckOk_LongCommand_NotTruncated) {
+    std::string cmd(70, 'C');
+
+    handler->sendAckOk(manager, cmd.c_str());
+
+    EXPECT_EQ(stream.output, "ACK:" + cmd + "=ok\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, SendAckErr_RamError_WritesError) {
+    handler->sendAckErr(manager, "MOVE", "blocked");
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=blocked\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, SendAckErr_EmptyRamError_UsesDefault) {
+    handler->sendAckErr(manager, "MOVE", "");
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=error\n");
+}
+
+TEST_F(BaseCommandHandlerAckTest, AckOk_Builder_WritesParamsInOnePass) {
+    handler->ackOk(manager, "GPIO").kv("pin", 13).kv("state", "ON").send();
+
+    EXPECT_EQ(stream.output, "ACK:GPIO=ok:pin=13;state=ON\n");
+}
+
+// Acknowledges through sendAckOk when dispatched by the manager
+class AckOkCommandHandler : public BaseCommandHandler {
+public:
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                      const StringKeyValue params[], uint8_t paramCount) override {
+        sendAckOk(sender, command);
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "MOVE" };
+        count = 1;
+        return cmds;
+    }
+};
+
+TEST_F(BaseCommandHandlerAckTest, SendAckOk_CorrelatedCommand_EchoesId) {
+    AckOkCommandHandler moveHandler;
+    ISerialCommandHandler* handlers[] = { &moveHandler };
+    manager->registerHandlers(handlers, 1);
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+
+    stream.input = "MOVE:#=12\n";
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=ok:#=12\n");
+}
+
 // ============================================================================
 // Interface Tests
 // ============================================================================
@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+#include <ArduinoFake.h>
+
+#if defined(__linux__)
+
+#include <string>
+#include <chrono>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "SerialCommandManager.h"
+#include "FdStream.h"
+#include "CommandClient.h"
+
+// ============================================================================
+// Device side handler, replies with the pin it was given
+// ============================================================================
+
+class LedHandler : public ISerialCommandHandler {
+public:
+    int calls = 0;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        calls++;
+        StringKeyValue reply = { "pin", "" };
+
+        if (paramCount > 0)
+            strcpy(reply.value, params[0].value);
+
+        sender->sendAck(command, "ok", &reply, 1);
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "LED", "MOVE" };
+        count = 2;
+        return cmds;
+    }
+};
+
+// Client on the pty master, a real SerialCommandManager device on the pty slave
+class CommandClientTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        ASSERT_GE(master, 0);
+        ASSERT_EQ(grantpt(master), 0);
+        ASSERT_EQ(unlockpt(master), 0);
+        ASSERT_TRUE(devicePort.openTty(ptsname(master), 115200));
+        hostPort.attach(master, true);
+
+        device = new SerialCommandManager(&devicePort, nullptr);
+        ISerialCommandHandler* handlers[] = { &led };
+        device->registerHandlers(handlers, 1);
+
+        host = new SerialCommandManager(&hostPort, nullptr);
+        client = new CommandClient(host, 4, 100);
+        client->setClock([this]() { return now; });
+    }
+
+    void TearDown() override {
+        delete client;
+        delete host;
+        delete device;
+    }
+
+    // Lets the pty carry the bytes, then services both ends
+    void pump(int rounds = 4) {
+        for (int i = 0; i < rounds; i++) {
+            usleep(2000);
+
+            for (int j = 0; j < 8; j++)
+                device->readCommands();
+
+            usleep(2000);
+            client->poll();
+        }
+    }
+
+    FdStream devicePort;
+    FdStream hostPort;
+    SerialCommandManager* device;
+    SerialCommandManager* host;
+    CommandClient* client;
+    LedHandler led;
+    uint32_t now = 1000;
+};
+
+TEST_F(CommandClientTest, Send_AckCompletesFuture) {
+    StringKeyValue params[] = { { "pin", "13" } };
+
+    std::future<CommandResult> reply = client->send("LED", nullptr, params, 1);
+    pump();
+
+    ASSERT_EQ(reply.wait_for(std::chrono::milliseconds(0)), std::future_status::ready);
+    CommandResult result = reply.get();
+    EXPECT_TRUE(result.isOk());
+    EXPECT_EQ(result.command, "LED");
+    ASSERT_EQ(result.params.size(), 1u);
+    EXPECT_STREQ(result.params[0].key, "pin");
+    EXPECT_STREQ(result.params[0].value, "13");
+}
+
+TEST_F(CommandClientTest, Send_PipelinedCommands_MatchedInOrder) {
+    std::vector<std::future<CommandResult>> replies;
+
+    for (int i = 0; i < 4; i++) {
+        StringKeyValue params[] = { { "pin", "" } };
+        snprintf(params[0].value, sizeof(params[0].value), "%d", i);
+        replies.push_back(client->send("LED", nullptr, params, 1));
+    }
+
+    EXPECT_EQ(client->getInFlight(), 4u);
+    pump();
+
+    EXPECT_EQ(led.calls, 4);
+
+    for (int i = 0; i < 4; i++) {
+        CommandResult result = replies[i].get();
+        EXPECT_TRUE(result.isOk());
+        EXPECT_EQ(atoi(result.params[0].value), i);
+    }
+}
+
+TEST_F(CommandClientTest, Send_WindowFull_QueuesUntilAcked) {
+    int completed = 0;
+
+    for (int i = 0; i < 6; i++)
+        client->send([&completed](const CommandResult& result) { completed += result.isOk(); }, "MOVE");
+
+    EXPECT_EQ(client->getInFlight(), 4u);
+    EXPECT_EQ(client->getWaiting(), 2u);
+
+    pump(8);
+
+    EXPECT_EQ(completed, 6);
+    EXPECT_EQ(client->getInFlight(), 0u);
+    EXPECT_EQ(client->getWaiting(), 0u);
+}
+
+TEST_F(CommandClientTest, Send_NoReply_TimesOut) {
+    std::future<CommandResult> reply = client->send("UNKNOWN");
+
+    now += 99;
+    client->poll();
+    EXPECT_EQ(reply.wait_for(std::chrono::milliseconds(0)), std::future_status::timeout);
+
+    now += 20;
+    client->poll();
+    ASSERT_EQ(reply.wait_for(std::chrono::milliseconds(0)), std::future_status::ready);
+
+    CommandResult result = reply.get();
+    EXPECT_TRUE(result.timedOut);
+    EXPECT_FALSE(result.isOk());
+    EXPECT_EQ(client->getInFlight(), 0u);
+}
+
+TEST_F(CommandClientTest, Send_TimeoutCallbackSendsAgain_RetryTimesOutToo) {
+    int timeouts = 0;
+    std::function<void(const CommandResult&)> retry = [&](const CommandResult& result) {
+        if (result.timedOut && ++timeouts < 2)
+            client->send(retry, "UNKNOWN");
+    };
+
+    client->send(retry, "UNKNOWN");
+
+    // Due 1100, expired at a time whose own retry lands in the same wheel slot
+    now = 1640;
+    client->poll();
+    EXPECT_EQ(timeouts, 1);
+    EXPECT_EQ(client->getInFlight(), 1u);
+
+    now += 120;
+    client->poll();
+    EXPECT_EQ(timeouts, 2);
+    EXPECT_EQ(client->getInFlight(), 0u);
+}
+
+TEST_F(CommandClientTest, Send_CommandNameTooLong_RejectedWithoutSending) {
+    std::future<CommandResult> reply = client->send("CALIBRATEALL");
+
+    ASSERT_EQ(reply.wait_for(std::chrono::milliseconds(0)), std::future_status::ready);
+    CommandResult result = reply.get();
+    EXPECT_TRUE(result.rejected);
+    EXPECT_FALSE(result.timedOut);
+    EXPECT_FALSE(result.isOk());
+    EXPECT_EQ(result.command, "CALIBRATEALL");
+    EXPECT_EQ(client->getInFlight(), 0u);
+    EXPECT_EQ(client->getWaiting(), 0u);
+}
+
+TEST_F(CommandClientTest, Send_LongTimeout_SurvivesWheelRotation) {
+    CommandClient slow(host, 1, 2000);
+    slow.setClock([this]() { return now; });
+    std::future<CommandResult> reply = slow.send("UNKNOWN");
+
+    for (int i = 0; i < 19; i++) {
+        now += 100;
+        slow.poll();
+    }
+
+    EXPECT_EQ(reply.wait_for(std::chrono::milliseconds(0)), std::future_status::timeout);
+
+    now += 120;
+    slow.poll();
+    EXPECT_TRUE(reply.get().timedOut);
+}
+
+TEST_F(CommandClientTest, CorrelationIds_RepliesOutOfOrder_MatchedById) {
+    client->setCorrelationIds(true);
+    std::future<CommandResult> first = client->send("LED", "first");
+    std::future<CommandResult> second = client->send("LED", "second");
+
+    // Answer as a device completing the second request first
+    const char* replies = "ACK:LED=two:#=2\nACK:LED=one:#=1\n";
+    devicePort.write(reinterpret_cast<const uint8_t*>(replies), strlen(replies));
+    usleep(2000);
+    client->poll();
+
+    EXPECT_EQ(first.get().result, "one");
+    EXPECT_EQ(second.get().result, "two");
+}
+
+TEST_F(CommandClientTest, CorrelationIds_RealDevice_Echoed) {
+    client->setCorrelationIds(true);
+    StringKeyValue params[] = { { "pin", "5" } };
+
+    std::future<CommandResult> reply = client->send("LED", nullptr, params, 1);
+    pump();
+
+    CommandResult result = reply.get();
+    EXPECT_TRUE(result.isOk());
+    ASSERT_EQ(result.params.size(), 1u);
+    EXPECT_STREQ(result.params[0].value, "5");
+}
+
+TEST_F(CommandClientTest, CreditFlowControl_SendsOnlyWithinDeviceWindow) {
+    device->setFlowControl(FlowControl::Credit, 2);
+    host->setFlowControl(FlowControl::Credit);
+    pump(1);
+    ASSERT_EQ(host->getCredits(), 2);
+
+    std::vector<std::future<CommandResult>> replies;
+    for (int i = 0; i < 6; i++)
+        replies.push_back(client->send("LED"));
+
+    EXPECT_EQ(client->getInFlight(), 2u);
+    EXPECT_EQ(client->getWaiting(), 4u);
+
+    pump(8);
+
+    for (std::future<CommandResult>& reply : replies)
+        EXPECT_TRUE(reply.get().isOk());
+
+    EXPECT_EQ(host->getCredits(), 2);
+}
+
+#endif
+
+// ============================================================================
+// Run all tests
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+#include <ArduinoFake.h>
+
+#if defined(__linux__)
+
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SerialCommandManager.h"
+#include "FdStream.h"
+#include "CommandReactor.h"
+
+// ============================================================================
+// Handler recording which manager received each command
+// ============================================================================
+
+class CountingHandler : public ISerialCommandHandler {
+public:
+    int calls = 0;
+    SerialCommandManager* lastSender = nullptr;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        calls++;
+        lastSender = sender;
+        sender->sendAck(command, "ok");
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "PING" };
+        count = 1;
+        return cmds;
+    }
+};
+
+static CountingHandler s_handler;
+static ISerialCommandHandler* const s_handlers[] = { &s_handler };
+static const SerialCommandRegistry s_registry(s_handlers);
+
+// A device: socketpair, stream over one end and its manager
+struct Device {
+    int fds[2];
+    FdStream stream;
+    SerialCommandManager* manager;
+
+    Device() {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        stream.attach(fds[0], true);
+        manager = new SerialCommandManager(&stream, nullptr);
+        manager->setRegistry(&s_registry);
+    }
+
+    ~Device() {
+        delete manager;
+
+        if (fds[1] >= 0)
+            close(fds[1]);
+    }
+
+    std::string receive() {
+        char buffer[512];
+        ssize_t count = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+        return count > 0 ? std::string(buffer, (size_t)count) : std::string();
+    }
+};
+
+class CommandReactorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+        s_handler.calls = 0;
+        s_handler.lastSender = nullptr;
+    }
+
+    CommandReactor reactor;
+};
+
+TEST_F(CommandReactorTest, Poll_NoData_ServicesNothing) {
+    Device device;
+    ASSERT_TRUE(reactor.isValid());
+    ASSERT_TRUE(reactor.add(device.manager, &device.stream));
+
+    EXPECT_EQ(reactor.poll(0), 0);
+    EXPECT_EQ(s_handler.calls, 0);
+}
+
+TEST_F(CommandReactorTest, Poll_WakesOnlyManagerWithData) {
+    Device devices[8];
+
+    for (Device& device : devices)
+        ASSERT_TRUE(reactor.add(device.manager, &device.stream));
+
+    ASSERT_EQ(write(devices[5].fds[1], "PING\n", 5), 5);
+
+    EXPECT_EQ(reactor.poll(100), 1);
+    EXPECT_EQ(s_handler.calls, 1);
+    EXPECT_EQ(s_handler.lastSender, devices[5].manager);
+    EXPECT_EQ(devices[5].receive(), "ACK:PING=ok\n");
+    EXPECT_EQ(devices[4].receive(), "");
+}
+
+TEST_F(CommandReactorTest, Poll_PipelinedMessages_AllHandled) {
+    Device device;
+    ASSERT_TRUE(reactor.add(device.manager, &device.stream));
+
+    ASSERT_EQ(write(device.fds[1], "PING\nPING\nPING\n", 15), 15);
+
+    EXPECT_EQ(reactor.poll(100), 1);
+    EXPECT_EQ(s_handler.calls, 3);
+    EXPECT_EQ(device.receive(), "ACK:PING=ok\nACK:PING=ok\nACK:PING=ok\n");
+}
+
+TEST_F(CommandReactorTest, Poll_PartialMessageOnIdleStream_TimesOut) {
+    Device device;
+    ASSERT_TRUE(reactor.add(device.manager, &device.stream));
+
+    ASSERT_EQ(write(device.fds[1], "PI", 2), 2);
+    EXPECT_EQ(reactor.poll(100), 1);
+    EXPECT_TRUE(device.manager->isReceiving());
+
+    // Nothing more arrives, the timeout is still checked
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(1000);
+    EXPECT_EQ(reactor.poll(-1), 0);
+
+    EXPECT_TRUE(device.manager->isTimeout());
+    EXPECT_EQ(device.receive(), "ERR:Timeout: (SerialCommandManager)\n");
+}
+
+TEST_F(CommandReactorTest, Add_SameStreamTwice_Fails) {
+    Device device;
+
+    EXPECT_TRUE(reactor.add(device.manager, &device.stream));
+    EXPECT_FALSE(reactor.add(device.manager, &device.stream));
+    EXPECT_TRUE(reactor.remove(&device.stream));
+    EXPECT_FALSE(reactor.remove(&device.stream));
+}
+
+TEST_F(CommandReactorTest, Poll_PeerClosed_RemovesStream) {
+    Device device;
+    ASSERT_TRUE(reactor.add(device.manager, &device.stream));
+
+    close(device.fds[1]);
+    device.fds[1] = -1;
+
+    EXPECT_EQ(reactor.poll(100), 1);
+    EXPECT_FALSE(device.stream.isOpen());
+    EXPECT_FALSE(reactor.remove(&device.stream));
+}
+
+TEST_F(CommandReactorTest, Poll_QueuedOutput_SentWhenWritable) {
+    Device device;
+    device.stream.setWriteTimeout(0);
+    ASSERT_TRUE(device.manager->setTxBuffer(128));
+    ASSERT_TRUE(reactor.add(device.manager, &device.stream));
+
+    device.manager->sendCommand("DATA", "1");
+    reactor.watchOutput(&device.stream);
+
+    EXPECT_EQ(reactor.poll(100), 1);
+    EXPECT_EQ(device.manager->getTxPending(), 0);
+    EXPECT_EQ(device.receive(), "DATA:1\n");
+    EXPECT_EQ(reactor.poll(0), 0);
+}
+
+#endif
+
+// ============================================================================
+// Run all tests
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
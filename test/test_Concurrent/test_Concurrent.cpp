@@ -0,0 +1,361 @@
+#include <gtest/gtest.h>
+#include <ArduinoFake.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include "SerialCommandManager.h"
+#include "ConcurrentStream.h"
+#include "DeferredDispatchHandler.h"
+#include "../support/CaptureStream.h"
+
+#if SCM_CONCURRENT
+
+static std::vector<std::string> splitLines(const std::string& text) {
+    std::vector<std::string> lines;
+    std::stringstream stream(text);
+    std::string line;
+
+    while (std::getline(stream, line))
+        lines.push_back(line);
+
+    return lines;
+}
+
+// Replies from whichever thread runs it
+class EchoHandler : public ISerialCommandHandler {
+public:
+    std::atomic<int> calls{0};
+    std::thread::id lastThread;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        lastThread = std::this_thread::get_id();
+        calls++;
+        sender->sendAck(command, paramCount > 0 ? params[0].value : "ok");
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "ECHO" };
+        count = 1;
+        return cmds;
+    }
+};
+
+class ConcurrentTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+        port = new ConcurrentStream(&capture, 8);
+        manager = new SerialCommandManager(port, nullptr);
+    }
+
+    void TearDown() override {
+        delete manager;
+        delete port;
+    }
+
+    CaptureStream capture;
+    ConcurrentStream* port;
+    SerialCommandManager* manager;
+};
+
+// ============================================================================
+// ConcurrentStream Tests
+// ============================================================================
+
+TEST_F(ConcurrentTest, SendCommand_QueuedUntilSent) {
+    manager->sendCommand("PING", "");
+
+    EXPECT_EQ(capture.output, "");
+    EXPECT_EQ(port->sendQueued(), 1);
+    EXPECT_EQ(capture.output, "PING\n");
+}
+
+TEST_F(ConcurrentTest, Flush_QueuesPartialFrame) {
+    port->write(reinterpret_cast<const uint8_t*>("PART"), 4);
+    port->sendQueued();
+    EXPECT_EQ(capture.output, "");
+
+    port->flush();
+    port->sendQueued();
+    EXPECT_EQ(capture.output, "PART");
+}
+
+TEST_F(ConcurrentTest, OversizedFrame_DroppedAndCounted) {
+    std::string longFrame(ConcurrentFrameSize, 'x');
+    longFrame += "\n";
+    std::string fullFrame(ConcurrentFrameSize - 1, 'y');
+    fullFrame += "\n";
+
+    port->write(reinterpret_cast<const uint8_t*>(longFrame.data()), longFrame.size());
+    port->write(reinterpret_cast<const uint8_t*>(fullFrame.data()), fullFrame.size());
+    manager->sendCommand("PING", "");
+    port->sendQueued();
+
+    EXPECT_EQ(capture.output, fullFrame + "PING\n");
+    EXPECT_EQ(port->getDroppedFrames(), 1u);
+}
+
+TEST_F(ConcurrentTest, PartialFrameForOtherStream_CompletedFirst) {
+    CaptureStream otherCapture;
+    ConcurrentStream other(&otherCapture, 4);
+
+    other.write(reinterpret_cast<const uint8_t*>("PART"), 4);
+    manager->sendCommand("PING", "");
+    other.sendQueued();
+    port->sendQueued();
+
+    EXPECT_EQ(otherCapture.output, "PART");
+    EXPECT_EQ(capture.output, "PING\n");
+}
+
+TEST_F(ConcurrentTest, StreamDestroyedWithOtherThreadsPartialFrame_Discarded) {
+    CaptureStream otherCapture;
+    ConcurrentStream* other = new ConcurrentStream(&otherCapture, 4);
+    std::atomic<int> step{0};
+
+    std::thread writer([&]() {
+        other->write(reinterpret_cast<const uint8_t*>("PART"), 4);
+        step = 1;
+
+        while (step != 2)
+            std::this_thread::yield();
+
+        manager->sendCommand("PING", "");
+    });
+
+    while (step != 1)
+        std::this_thread::yield();
+
+    delete other;
+    step = 2;
+    writer.join();
+    port->sendQueued();
+
+    EXPECT_EQ(otherCapture.output, "");
+    EXPECT_EQ(capture.output, "PING\n");
+}
+
+TEST_F(ConcurrentTest, ManyThreads_FramesNeverInterleave) {
+    const int threadCount = 4;
+    const int messages = 500;
+    std::atomic<int> running(threadCount);
+    std::vector<std::thread> senders;
+
+    for (int t = 0; t < threadCount; t++) {
+        senders.emplace_back([this, t, &running]() {
+            char message[32];
+
+            for (int i = 0; i < messages; i++) {
+                snprintf(message, sizeof(message), "%d-%d", t, i);
+                manager->sendCommand("DATA", message);
+            }
+
+            running--;
+        });
+    }
+
+    // Single consumer, as the receiving task would be
+    while (running > 0)
+        port->sendQueued();
+
+    for (std::thread& sender : senders)
+        sender.join();
+
+    port->sendQueued();
+
+    std::vector<std::string> lines = splitLines(capture.output);
+    ASSERT_EQ(lines.size(), (size_t)(threadCount * messages));
+
+    int next[threadCount] = {};
+
+    for (const std::string& line : lines) {
+        int t = -1;
+        int i = -1;
+        ASSERT_EQ(sscanf(line.c_str(), "DATA:%d-%d", &t, &i), 2) << line;
+        ASSERT_GE(t, 0);
+        ASSERT_LT(t, threadCount);
+        EXPECT_EQ(i, next[t]++) << "messages from one thread are sent in order";
+    }
+}
+
+TEST_F(ConcurrentTest, CreditFlowControl_ManyThreads_EachSendSpendsOneCredit) {
+    const int threadCount = 4;
+    const int messages = 100;
+    manager->setFlowControl(FlowControl::Credit);
+    capture.input = "CREDIT:window=1000\n";
+    manager->readCommands();
+    ASSERT_EQ(manager->getCredits(), 1000);
+
+    std::vector<std::thread> senders;
+
+    for (int t = 0; t < threadCount; t++) {
+        senders.emplace_back([this]() {
+            for (int i = 0; i < messages; i++) {
+                manager->sendCommand("DATA", "x");
+                port->sendQueued();
+            }
+        });
+    }
+
+    for (std::thread& sender : senders)
+        sender.join();
+
+    EXPECT_EQ(manager->getCredits(), 1000 - threadCount * messages);
+}
+
+TEST_F(ConcurrentTest, DebugSetOnReceiver_SeenBySender) {
+    capture.input = "DEBUG:ON\n";
+    manager->readCommands();
+
+    std::thread sender([this]() { manager->sendDebug("from sender", ""); });
+    sender.join();
+    port->sendQueued();
+
+    EXPECT_NE(capture.output.find("DEBUG:from sender\n"), std::string::npos);
+}
+
+// ============================================================================
+// DeferredDispatchHandler Tests
+// ============================================================================
+
+class DeferredDispatchTest : public ConcurrentTest {
+protected:
+    void SetUp() override {
+        ConcurrentTest::SetUp();
+        handlers[0] = &echo;
+        registry = new SerialCommandRegistry(handlers, 1);
+        deferred = new DeferredDispatchHandler(registry, 2);
+
+        ISerialCommandHandler* managerHandlers[] = { deferred };
+        manager->registerHandlers(managerHandlers, 1);
+    }
+
+    void TearDown() override {
+        ConcurrentTest::TearDown();
+        delete deferred;
+        delete registry;
+    }
+
+    EchoHandler echo;
+    ISerialCommandHandler* handlers[1];
+    SerialCommandRegistry* registry;
+    DeferredDispatchHandler* deferred;
+};
+
+TEST_F(DeferredDispatchTest, Command_RunOnWorkerThread) {
+    capture.input = "ECHO:v=hello\n";
+    manager->readCommands();
+
+    EXPECT_EQ(echo.calls, 0);
+    EXPECT_EQ(deferred->getPending(), 1);
+
+    std::thread worker([this]() { deferred->runPending(); });
+    std::thread::id workerId = worker.get_id();
+    worker.join();
+    port->sendQueued();
+
+    EXPECT_EQ(echo.calls, 1);
+    EXPECT_EQ(echo.lastThread, workerId);
+    EXPECT_EQ(capture.output, "ACK:ECHO=hello\n");
+}
+
+TEST_F(DeferredDispatchTest, QueueFull_RepliesBusy) {
+    capture.input = "ECHO:v=1\nECHO:v=2\nECHO:v=3\n";
+
+    for (int i = 0; i < 3; i++)
+        manager->readCommands();
+
+    port->sendQueued();
+
+    EXPECT_EQ(capture.output, "ACK:ECHO=busy\n");
+    EXPECT_EQ(deferred->runPending(), 2);
+}
+
+TEST_F(DeferredDispatchTest, UnsupportedCommand_NotDeferred) {
+    capture.input = "OTHER\n";
+    manager->readCommands();
+
+    EXPECT_EQ(deferred->getPending(), 0);
+}
+
+TEST_F(DeferredDispatchTest, ReceiverAndWorkerThreads_AllCommandsRun) {
+    const int commands = 200;
+    std::atomic<bool> done(false);
+
+    std::thread worker([this, &done]() {
+        while (!done)
+            deferred->runPending();
+
+        deferred->runPending();
+    });
+
+    for (int i = 0; i < commands; i++) {
+        capture.input += "ECHO:v=x\n";
+        manager->readCommands();
+        port->sendQueued();
+
+        // Wait for room rather than testing the busy reply
+        while (deferred->getPending() >= 2)
+            std::this_thread::yield();
+    }
+
+    done = true;
+    worker.join();
+    port->sendQueued();
+
+    EXPECT_EQ(echo.calls, commands);
+    EXPECT_EQ(splitLines(capture.output).size(), (size_t)commands);
+}
+
+// Runs the deferred commands on a worker thread while the reader is handling RUN
+class RunWorkerHandler : public ISerialCommandHandler {
+public:
+    DeferredDispatchHandler* deferred = nullptr;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        std::thread worker([this]() { deferred->runPending(); });
+        worker.join();
+        sender->sendAck(command, "ok");
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "RUN" };
+        count = 1;
+        return cmds;
+    }
+};
+
+TEST_F(DeferredDispatchTest, CorrelationIds_EchoQueuedIdNotCurrentMessage) {
+    RunWorkerHandler run;
+    run.deferred = deferred;
+    ISerialCommandHandler* managerHandlers[] = { deferred, &run };
+    manager->registerHandlers(managerHandlers, 2);
+
+    capture.input = "ECHO:#=1;v=a\nECHO:#=2;v=b\nRUN:#=9\n";
+
+    for (int i = 0; i < 3; i++)
+        manager->readCommands();
+
+    port->sendQueued();
+
+    EXPECT_EQ(capture.output, "ACK:ECHO=a:#=1\nACK:ECHO=b:#=2\nACK:RUN=ok:#=9\n");
+}
+
+#endif
+
+// ============================================================================
+// Run all tests
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+#include <ArduinoFake.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "SerialCommandManager.h"
+#include "../support/CaptureStream.h"
+
+// Built with SCM_DIAGNOSTICS=1, SCM_COMMAND_STATS=8 and SCM_TRACE_HOOK=recordTrace,
+// see [env:native_diagnostics] in platformio.ini
+
+struct TraceRecord {
+    TraceEvent event;
+    uint32_t timestamp;
+};
+
+static std::vector<TraceRecord> traces;
+
+void recordTrace(SerialCommandManager* manager, TraceEvent event, uint32_t timestamp) {
+    traces.push_back({ event, timestamp });
+}
+
+class DiagnosticsTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(812);
+        When(Method(ArduinoFake(), micros)).AlwaysReturn(0);
+        manager = new SerialCommandManager(&stream, nullptr);
+        traces.clear();
+    }
+
+    void TearDown() override {
+        delete manager;
+    }
+
+    // Sends one message and returns the reply
+    std::string command(const char* message) {
+        stream.input += message;
+        stream.output.clear();
+        manager->readCommands();
+        return stream.output;
+    }
+
+    CaptureStream stream;
+    SerialCommandManager* manager;
+};
+
+// ============================================================================
+// Diagnostics Command Tests
+// ============================================================================
+
+TEST_F(DiagnosticsTest, Mem_ReportsBufferSizes) {
+    manager->setTxBuffer(64);
+
+    // Free heap and stack are not reported on native builds
+    EXPECT_EQ(command("MEM\n"), "MEM:rx=128;tx=64;log=0\n");
+}
+
+TEST_F(DiagnosticsTest, Ping_EchoesHostTimeWithDeviceTime) {
+    EXPECT_EQ(command("PING:t=5000\n"), "PING:t=5000;ms=812\n");
+}
+
+TEST_F(DiagnosticsTest, Stats_CountsMessagesAndUnhandled) {
+    command("LED:on\n");
+    command("MOTOR:off\n");
+
+    EXPECT_EQ(command("STATS\n"), "STATS:rx=3;unk=2;err=0;avg=0;max=0\n");
+}
+
+TEST_F(DiagnosticsTest, Stats_LibraryErrors_Counted) {
+    command("LED:averyveryverylongkey=1\n");
+    manager->readCommands();    // the rest of the message, "=1", is read as a message of its own
+
+    EXPECT_EQ(command("STATS\n"), "STATS:rx=2;unk=1;err=1;avg=0;max=0\n");
+}
+
+TEST_F(DiagnosticsTest, Stats_Reset_ZeroesCounters) {
+    command("LED:on\n");
+
+    EXPECT_EQ(command("STATS:RESET\n"), "ACK:STATS=ok\n");
+    EXPECT_EQ(command("STATS\n"), "STATS:rx=1;unk=0;err=0;avg=0;max=0\n");
+}
+
+TEST_F(DiagnosticsTest, Perf_ReportsWindowAndRestarts) {
+    command("LED:on\n");
+    manager->readCommands();
+
+    When(Method(ArduinoFake(), micros)).AlwaysReturn(1000000);
+    EXPECT_EQ(command("PERF\n"), "PERF:busy=0.0;calls=2;avg=0;ms=1000\n");
+    EXPECT_EQ(command("PERF\n"), "PERF:busy=0.0;calls=1;avg=0;ms=0\n");
+}
+
+// ============================================================================
+// Command Statistics Tests
+// ============================================================================
+
+// MOVE takes 300us (histogram bucket 8), FAIL is never handled
+class TimedHandler : public ISerialCommandHandler {
+public:
+    unsigned long now = 0;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        if (strcmp(command, "FAIL") == 0)
+            return false;
+
+        now += 300;
+        When(Method(ArduinoFake(), micros)).AlwaysReturn(now);
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "MOVE", "FAIL" };
+        count = 2;
+        return cmds;
+    }
+};
+
+static void ignoreMessage(SerialCommandManager* sender) {
+}
+
+class CommandStatsTest : public DiagnosticsTest {
+protected:
+    void SetUp() override {
+        DiagnosticsTest::SetUp();
+        ISerialCommandHandler* handlers[] = { &handler };
+        manager->registerHandlers(handlers, 1);
+    }
+
+    TimedHandler handler;
+};
+
+TEST_F(CommandStatsTest, HandledCommand_CountedWithHandlerTime) {
+    command("MOVE:x=1\n");
+    command("MOVE:x=2\n");
+
+    const CommandStats* stats = manager->getCommandStats("MOVE");
+    ASSERT_NE(stats, nullptr);
+    EXPECT_EQ(stats->received, 2u);
+    EXPECT_EQ(stats->handled, 2u);
+    EXPECT_EQ(stats->failed, 0u);
+    EXPECT_EQ(stats->histogram[8], 2);
+    EXPECT_EQ(manager->getParseHistogram()[0], 2);
+}
+
+TEST_F(CommandStatsTest, UnhandledCommands_FailedAndUnlistedCounted) {
+    command("FAIL\n");
+    command("XYZ\n");
+
+    ASSERT_EQ(manager->getCommandStatsCount(), 2);
+    EXPECT_STREQ(manager->getCommandStatsAt(0)->command, "FAIL");
+    EXPECT_EQ(manager->getCommandStatsAt(0)->failed, 1u);
+    EXPECT_STREQ(manager->getCommandStatsAt(1)->command, "*");
+    EXPECT_EQ(manager->getCommandStatsAt(1)->failed, 0u);
+    EXPECT_EQ(manager->getCommandStatsAt(1)->fellThrough, 0u);
+}
+
+TEST_F(CommandStatsTest, Callback_FellThroughCounted) {
+    SerialCommandManager withCallback(&stream, ignoreMessage);
+    ISerialCommandHandler* handlers[] = { &handler };
+    withCallback.registerHandlers(handlers, 1);
+
+    stream.input = "FAIL\n";
+    withCallback.readCommands();
+
+    EXPECT_EQ(withCallback.getCommandStats("FAIL")->fellThrough, 1u);
+}
+
+TEST_F(CommandStatsTest, SendCommandStats_WritesCompactFrames) {
+    command("MOVE\n");
+    stream.output.clear();
+
+    manager->sendCommandStats();
+
+    EXPECT_EQ(stream.output,
+        "STAT:MOVE=1;ok=1;fail=0;cb=0;us=0,0,0,0,0,0,0,0,1\n"
+        "STAT:parse=1;us=1\n");
+}
+
+TEST_F(CommandStatsTest, Reset_ClearsCounters) {
+    command("MOVE\n");
+
+    manager->resetCommandStats();
+
+    EXPECT_EQ(manager->getCommandStatsCount(), 0);
+    EXPECT_EQ(manager->getCommandStats("MOVE"), nullptr);
+    EXPECT_EQ(manager->getParseHistogram()[0], 0);
+}
+
+// ============================================================================
+// Trace Hook Tests
+// ============================================================================
+
+TEST_F(CommandStatsTest, Trace_HandledCommand_ReportsEachPointWithTimestamp) {
+    command("MOVE\n");
+
+    ASSERT_EQ(traces.size(), 5u);
+    EXPECT_EQ(traces[0].event, TraceEvent::FirstByte);
+    EXPECT_EQ(traces[1].event, TraceEvent::Terminator);
+    EXPECT_EQ(traces[2].event, TraceEvent::CommandResolved);
+    EXPECT_EQ(traces[3].event, TraceEvent::HandlerEnter);
+    EXPECT_EQ(traces[4].event, TraceEvent::HandlerExit);
+    EXPECT_EQ(traces[4].timestamp - traces[3].timestamp, 300u);
+}
+
+TEST_F(DiagnosticsTest, Trace_Reply_ReportsTransmitInsideHandler) {
+    command("PING:t=1\n");
+
+    ASSERT_EQ(traces.size(), 7u);
+    EXPECT_EQ(traces[3].event, TraceEvent::HandlerEnter);
+    EXPECT_EQ(traces[4].event, TraceEvent::TxStart);
+    EXPECT_EQ(traces[5].event, TraceEvent::TxEnd);
+    EXPECT_EQ(traces[6].event, TraceEvent::HandlerExit);
+}
+
+// ============================================================================
+// Run all tests
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <ArduinoFake.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <string>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SerialCommandManager.h"
+#include "FdStream.h"
+
+// ============================================================================
+// FdStream over a socketpair, the test holds the other end
+// ============================================================================
+
+class FdStreamTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        stream = new FdStream(fds[0], true);
+    }
+
+    void TearDown() override {
+        delete stream;
+
+        if (fds[1] >= 0)
+            close(fds[1]);
+    }
+
+    void send(const std::string& data) {
+        ASSERT_EQ(write(fds[1], data.data(), data.size()), (ssize_t)data.size());
+    }
+
+    std::string receive() {
+        char buffer[512];
+        ssize_t count = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+        return count > 0 ? std::string(buffer, (size_t)count) : std::string();
+    }
+
+    int fds[2];
+    FdStream* stream;
+};
+
+TEST_F(FdStreamTest, Available_NoData_ReturnsZero) {
+    EXPECT_TRUE(stream->isOpen());
+    EXPECT_EQ(stream->available(), 0);
+    EXPECT_EQ(stream->read(), -1);
+}
+
+TEST_F(FdStreamTest, Read_BufferedData_ReturnsBytesInOrder) {
+    send("AB");
+
+    EXPECT_EQ(stream->available(), 2);
+    EXPECT_EQ(stream->peek(), 'A');
+    EXPECT_EQ(stream->read(), 'A');
+    EXPECT_EQ(stream->read(), 'B');
+    EXPECT_EQ(stream->available(), 0);
+}
+
+TEST_F(FdStreamTest, Write_SendsBytes) {
+    EXPECT_EQ(stream->write(reinterpret_cast<const uint8_t*>("PING\n"), 5), 5u);
+
+    EXPECT_EQ(receive(), "PING\n");
+}
+
+TEST_F(FdStreamTest, Read_PeerClosed_NotOpen) {
+    close(fds[1]);
+    fds[1] = -1;
+
+    EXPECT_EQ(stream->available(), 0);
+    EXPECT_FALSE(stream->isOpen());
+}
+
+TEST_F(FdStreamTest, Manager_CommandOverSocket_RepliesOnSocket) {
+    SerialCommandManager manager(stream, nullptr);
+    send("DEBUG:ON\n");
+
+    manager.readCommands();
+
+    EXPECT_NE(receive().find("DEBUG:ON\n"), std::string::npos);
+}
+
+TEST(FdStreamPtyTest, Manager_CommandOverPty_RepliesOnPty) {
+    ArduinoFakeReset();
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT_GE(master, 0);
+    ASSERT_EQ(grantpt(master), 0);
+    ASSERT_EQ(unlockpt(master), 0);
+
+    FdStream device;
+    ASSERT_TRUE(device.openTty(ptsname(master), 115200));
+    SerialCommandManager manager(&device, nullptr);
+
+    ASSERT_EQ(write(master, "DEBUG:ON\n", 9), 9);
+    usleep(10000);
+    manager.readCommands();
+    usleep(10000);
+
+    char buffer[128];
+    ssize_t count = read(master, buffer, sizeof(buffer));
+    ASSERT_GT(count, 0);
+    EXPECT_NE(std::string(buffer, (size_t)count).find("DEBUG:ON\n"), std::string::npos);
+
+    device.close();
+    close(master);
+}
+
+#endif
+
+// ============================================================================
+// Run all tests
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
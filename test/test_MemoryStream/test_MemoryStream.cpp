@@ -0,0 +1,255 @@
+#include <gtest/gtest.h>
+#include <ArduinoFake.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "SerialCommandManager.h"
+#include "BaseCommandHandler.h"
+#include "MemoryStream.h"
+
+// Collects everything the manager has written so far
+static std::string extractAll(MemoryStream& stream) {
+    std::string output;
+    uint8_t buffer[64];
+    size_t count;
+
+    while ((count = stream.extract(buffer, sizeof(buffer))) > 0)
+        output.append(reinterpret_cast<const char*>(buffer), count);
+
+    return output;
+}
+
+// ============================================================================
+// Ring Buffer Tests
+// ============================================================================
+
+TEST(MemoryStreamTest, Inject_WrapsAround_ReadsInOrder) {
+    uint8_t rx[8];
+    uint8_t tx[8];
+    MemoryStream stream(rx, sizeof(rx), tx, sizeof(tx));
+    char buffer[8];
+
+    EXPECT_EQ(stream.inject("ABCDEF"), 6u);
+    EXPECT_EQ(stream.readBytes(buffer, 4), 4u);
+    EXPECT_EQ(stream.inject("GHIJKL"), 6u);
+    EXPECT_EQ(stream.inject("M"), 0u);
+
+    EXPECT_EQ(stream.available(), 8);
+    EXPECT_EQ(stream.peek(), 'E');
+    EXPECT_EQ(stream.readBytes(buffer, sizeof(buffer)), 8u);
+    EXPECT_EQ(std::string(buffer, 8), "EFGHIJKL");
+    EXPECT_EQ(stream.read(), -1);
+}
+
+TEST(MemoryStreamTest, Write_RingFull_ReportsRoomAndCountsOverflow) {
+    MemoryStream stream(16, 8);
+
+    EXPECT_EQ(stream.availableForWrite(), 8);
+    EXPECT_EQ(stream.write(reinterpret_cast<const uint8_t*>("0123456789"), 10), 8u);
+    EXPECT_EQ(stream.availableForWrite(), 0);
+    EXPECT_EQ(stream.write('X'), 0u);
+
+    EXPECT_EQ(stream.getOverflow(), 3u);
+    EXPECT_EQ(extractAll(stream), "01234567");
+    EXPECT_EQ(stream.availableForWrite(), 8);
+}
+
+TEST(MemoryStreamTest, BaudRate_DeliversBytesAtLineSpeed) {
+    MemoryStream stream;
+    stream.setBaudRate(9600);     // 1041.7us per byte
+
+    stream.inject("AB");
+    EXPECT_EQ(stream.available(), 0);
+
+    stream.advance(1000);
+    EXPECT_EQ(stream.available(), 0);
+
+    stream.advance(100);
+    EXPECT_EQ(stream.available(), 1);
+
+    stream.advance(1000);
+    EXPECT_EQ(stream.available(), 2);
+    EXPECT_EQ(stream.clockMillis(), 2u);
+}
+
+TEST(MemoryStreamTest, BaudRate_IdleLine_BanksNoTime) {
+    MemoryStream stream;
+    stream.setBaudRate(9600);
+
+    stream.advance(100000);
+    stream.inject("A");
+
+    EXPECT_EQ(stream.available(), 0);
+    stream.advance(1042);
+    EXPECT_EQ(stream.available(), 1);
+}
+
+TEST(MemoryStreamTest, Write_LargeRingWraps_ByteWritesStayInRing) {
+    MemoryStream stream(16, 40000);
+    std::vector<uint8_t> block(39000, 'a');
+    std::vector<uint8_t> buffer(40000);
+
+    // Head near the end of the ring, so head + count passes 65535 for the byte writes below
+    EXPECT_EQ(stream.write(block.data(), block.size()), block.size());
+    EXPECT_EQ(stream.extract(buffer.data(), buffer.size()), block.size());
+    EXPECT_EQ(stream.write(block.data(), 30000), 30000u);
+
+    for (int i = 0; i < 10000; i++)
+        stream.write('b');
+
+    EXPECT_EQ(stream.write('c'), 0u);
+    ASSERT_EQ(stream.extract(buffer.data(), buffer.size()), 40000u);
+    EXPECT_EQ(std::string(buffer.begin(), buffer.begin() + 30000), std::string(30000, 'a'));
+    EXPECT_EQ(std::string(buffer.begin() + 30000, buffer.end()), std::string(10000, 'b'));
+}
+
+TEST(MemoryStreamTest, Loopback_ByteWrites_PacedLikeBulkWrites) {
+    MemoryStream stream;
+    stream.setBaudRate(9600);
+    stream.setLoopback(true);
+
+    stream.write('A');
+    stream.write(reinterpret_cast<const uint8_t*>("B"), 1);
+    EXPECT_EQ(stream.available(), 0);
+
+    stream.advance(1042);
+    EXPECT_EQ(stream.available(), 1);
+
+    stream.advance(1042);
+    EXPECT_EQ(stream.available(), 2);
+}
+
+// ============================================================================
+// Manager Tests
+// ============================================================================
+
+class CountingHandler : public BaseCommandHandler {
+public:
+    uint32_t count = 0;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        count++;
+        sendAckOk(sender, command, nullptr, 0);
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "LED" };
+        count = 1;
+        return cmds;
+    }
+};
+
+class MemoryStreamManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+        When(Method(ArduinoFake(), micros)).AlwaysReturn(0);
+        manager = new SerialCommandManager(&stream, nullptr);
+        ISerialCommandHandler* handlers[] = { &handler };
+        manager->registerHandlers(handlers, 1);
+    }
+
+    void TearDown() override {
+        delete manager;
+    }
+
+    // Moves the stream's clock and millis() together
+    void advance(uint32_t micros) {
+        stream.advance(micros);
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(stream.clockMillis());
+    }
+
+    MemoryStream stream;
+    CountingHandler handler;
+    SerialCommandManager* manager;
+};
+
+TEST_F(MemoryStreamManagerTest, Throughput_MegabyteOfMessages_AllHandled) {
+    const char* message = "LED:pin=13;state=on\n";     // 20 bytes
+    const size_t length = strlen(message);
+    const uint32_t messages = 50000;
+    size_t sent = 0;
+    size_t replyBytes = 0;
+
+    // The 256 byte receive ring takes what fits, often part of a message
+    while (handler.count < messages) {
+        size_t count;
+        while (sent < messages * length &&
+               (count = stream.inject(reinterpret_cast<const uint8_t*>(message) + sent % length,
+                                      length - sent % length)) > 0)
+            sent += count;
+
+        while (stream.available() > 0)
+            manager->readCommands();
+
+        replyBytes += extractAll(stream).size();
+    }
+
+    EXPECT_EQ(handler.count, messages);
+    EXPECT_EQ(replyBytes, messages * strlen("ACK:LED=ok\n"));
+    EXPECT_EQ(stream.getOverflow(), 0u);
+}
+
+TEST_F(MemoryStreamManagerTest, Timeout_SlowLine_ReportedOnVirtualClock) {
+    stream.setBaudRate(9600);
+    stream.inject("LED:on");
+
+    for (int i = 0; i < 8; i++) {
+        advance(1042);
+        manager->readCommands();
+    }
+
+    EXPECT_FALSE(manager->isTimeout());
+
+    advance(500000);
+    manager->readCommands();
+    EXPECT_TRUE(manager->isTimeout());
+
+    // The 36 byte error is still on the line until its transfer time has passed
+    advance(1042 * 24);
+    EXPECT_EQ(extractAll(stream), "ERR:Timeout: (SerialComm");
+    advance(1042 * 12);
+    EXPECT_EQ(extractAll(stream), "andManager)\n");
+}
+
+TEST_F(MemoryStreamManagerTest, Backpressure_SmallPort_TxBufferDrainsAsHostReads) {
+    uint8_t rx[16];
+    uint8_t tx[8];
+    MemoryStream port(rx, sizeof(rx), tx, sizeof(tx));
+    SerialCommandManager device(&port, nullptr);
+    ASSERT_TRUE(device.setTxBuffer(64));
+
+    for (int i = 0; i < 4; i++)
+        device.sendCommand("ACK", "LED=ok");
+
+    std::string output = extractAll(port);
+    while (device.getTxPending() > 0) {
+        device.poll();
+        output += extractAll(port);
+    }
+
+    EXPECT_EQ(output, "ACK:LED=ok\nACK:LED=ok\nACK:LED=ok\nACK:LED=ok\n");
+    EXPECT_EQ(port.getOverflow(), 0u);
+}
+
+TEST_F(MemoryStreamManagerTest, Loopback_ParsesOwnOutput) {
+    stream.setLoopback(true);
+
+    manager->sendCommand("LED", "on");
+    manager->readCommands();
+
+    EXPECT_EQ(handler.count, 1u);
+    EXPECT_EQ(stream.available(), (int)strlen("ACK:LED=ok\n"));
+}
+
+// ============================================================================
+// Run all tests
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
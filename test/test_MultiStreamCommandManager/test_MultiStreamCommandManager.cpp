@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <ArduinoFake.h>
+#include <string.h>
+#include <string>
+#include "SerialCommandManager.h"
+#include "MultiStreamCommandManager.h"
+#include "../support/CaptureStream.h"
+
+// Replies to PING on whichever stream it arrived, records the order commands were handled
+class PingHandler : public ISerialCommandHandler {
+public:
+    std::string handled;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        handled += params && paramCount > 0 ? params[0].value : "?";
+        sender->sendAck(command, "ok");
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "PING" };
+        count = 1;
+        return cmds;
+    }
+};
+
+class MultiStreamTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+
+        first = new SerialCommandManager(&firstStream, nullptr);
+        second = new SerialCommandManager(&secondStream, nullptr);
+        managers[0] = first;
+        managers[1] = second;
+        multi = new MultiStreamCommandManager(managers, 2);
+
+        ISerialCommandHandler* handlers[] = { &handler };
+        multi->registerHandlers(handlers, 1);
+    }
+
+    void TearDown() override {
+        delete multi;
+        delete second;
+        delete first;
+    }
+
+    CaptureStream firstStream;
+    CaptureStream secondStream;
+    SerialCommandManager* first;
+    SerialCommandManager* second;
+    SerialCommandManager* managers[2];
+    MultiStreamCommandManager* multi;
+    PingHandler handler;
+};
+
+TEST_F(MultiStreamTest, GetManager_ReturnsManagers) {
+    EXPECT_EQ(multi->getManagerCount(), 2);
+    EXPECT_EQ(multi->getManager(0), first);
+    EXPECT_EQ(multi->getManager(1), second);
+    EXPECT_EQ(multi->getManager(2), nullptr);
+}
+
+TEST_F(MultiStreamTest, ReadCommands_RepliesOnOriginatingStream) {
+    secondStream.input = "PING:n=2\n";
+
+    multi->readCommands();
+
+    EXPECT_EQ(firstStream.output, "");
+    EXPECT_EQ(secondStream.output, "ACK:PING=ok\n");
+}
+
+TEST_F(MultiStreamTest, ReadCommands_SharedHandlersServeEveryStream) {
+    firstStream.input = "PING:n=1\n";
+    secondStream.input = "PING:n=2\n";
+
+    multi->readCommands();
+
+    EXPECT_EQ(firstStream.output, "ACK:PING=ok\n");
+    EXPECT_EQ(secondStream.output, "ACK:PING=ok\n");
+}
+
+TEST_F(MultiStreamTest, ReadCommands_DebugIsPerStream) {
+    firstStream.input = "DEBUG:ON\n";
+
+    multi->readCommands();
+    first->sendDebug("one", "");
+    second->sendDebug("two", "");
+
+    EXPECT_NE(firstStream.output.find("DEBUG:one"), std::string::npos);
+    EXPECT_EQ(secondStream.output, "");
+}
+
+TEST_F(MultiStreamTest, ReadCommands_BusyStreamDoesNotStarveOthers) {
+    multi->setBytesPerPoll(9);
+
+    for (int i = 0; i < 5; i++)
+        firstStream.input += "PING:n=A\n";
+
+    secondStream.input = "PING:n=B\n";
+
+    multi->readCommands();
+
+    EXPECT_EQ(handler.handled, "AB");
+}
+
+TEST_F(MultiStreamTest, ReadCommands_RotatesStartingStream) {
+    multi->setBytesPerPoll(9);
+    firstStream.input = "PING:n=A\nPING:n=A\n";
+    secondStream.input = "PING:n=B\nPING:n=B\n";
+
+    multi->readCommands();
+    multi->readCommands();
+
+    EXPECT_EQ(handler.handled, "ABBA");
+}
+
+// ============================================================================
+// Run all tests
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 #include <ArduinoFake.h>
 #include <string.h>
+#include <string>
 #include "SerialCommandManager.h"
+#include "../support/CaptureStream.h"
 
 // ============================================================================
 // Test ISerialCommandHandler Interface
@@ -251,6 +253,1109 @@ TEST(ConstantsTest, ParamKeyLength_IsSmallerThanValueLength) {
     EXPECT_LT(DefaultMaxParamKeyLength, DefaultMaxParamValueLength);
 }
 
+// ============================================================================
+// Message Sending Tests
+// ============================================================================
+
+class SendCommandTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        manager = new SerialCommandManager(&stream, nullptr);
+    }
+
+    void TearDown() override {
+        delete manager;
+    }
+
+    CaptureStream stream;
+    SerialCommandManager* manager;
+};
+
+TEST_F(SendCommandTest, SendCommand_HeaderOnly_WritesHeaderAndTerminator) {
+    manager->sendCommand("PING", "");
+
+    EXPECT_EQ(stream.output, "PING\n");
+}
+
+TEST_F(SendCommandTest, SendCommand_WithMessage_WritesSeparatedMessage) {
+    manager->sendCommand("ACK", "LED=ok");
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok\n");
+}
+
+TEST_F(SendCommandTest, SendCommand_TrailingCrLf_IsStripped) {
+    manager->sendCommand("ACK", "LED=ok\r\n");
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok\n");
+}
+
+TEST_F(SendCommandTest, SendCommand_OnlyCrLf_TreatedAsEmpty) {
+    manager->sendCommand("ACK", "\r\n");
+
+    EXPECT_EQ(stream.output, "ACK\n");
+}
+
+TEST_F(SendCommandTest, SendCommand_WithParamsAndIdentifier_WritesAllParts) {
+    StringKeyValue params[2] = { { "pin", "12" }, { "state", "ON" } };
+
+    manager->sendCommand("LED", "Update", "Ctrl1", params, 2);
+
+    EXPECT_EQ(stream.output, "LED:Update:pin=12;state=ON: (Ctrl1)\n");
+}
+
+TEST_F(SendCommandTest, SendCommand_LongMessage_TruncatedToMaxMessageLength) {
+    std::string longMessage(DefaultMaxMessageLength + 20, 'x');
+
+    manager->sendCommand("LOG", longMessage.c_str());
+
+    EXPECT_EQ(stream.output, "LOG:" + std::string(DefaultMaxMessageLength, 'x') + "\n");
+}
+
+TEST_F(SendCommandTest, SendError_FlashMessage_StreamedWithIdentifier) {
+    manager->sendError(F("Bad value"), F("Handler"));
+
+    EXPECT_EQ(stream.output, "ERR:Bad value: (Handler)\n");
+}
+
+TEST_F(SendCommandTest, SendError_FlashIdentifier_NotTruncated) {
+    manager->sendError("Raw buffer full", F("SerialCommandManager"));
+
+    EXPECT_EQ(stream.output, "ERR:Raw buffer full: (SerialCommandManager)\n");
+}
+
+TEST_F(SendCommandTest, SendError_LongFlashMessage_StreamedInChunks) {
+    manager->sendError(F("A flash message much longer than a single chunk"), F("Src"));
+
+    EXPECT_EQ(stream.output, "ERR:A flash message much longer than a single chunk: (Src)\n");
+}
+
+TEST_F(SendCommandTest, SendCommand_FlashHeader_WritesHeader) {
+    StringKeyValue params[1] = { { "pin", "3" } };
+
+    manager->sendCommand(F("STATUS"), "ready", "", params, 1);
+
+    EXPECT_EQ(stream.output, "STATUS:ready:pin=3\n");
+}
+
+TEST_F(SendCommandTest, SendAck_FlashResult_WritesSinglePass) {
+    manager->sendAck("MOVE", F("invalid speed"));
+
+    EXPECT_EQ(stream.output, "ACK:MOVE=invalid speed\n");
+}
+
+TEST_F(SendCommandTest, SendDebug_DebugDisabled_WritesNothing) {
+    manager->sendDebug("hidden", "Test");
+    manager->sendDebug(F("hidden"), F("Test"));
+
+    EXPECT_EQ(stream.output, "");
+}
+
+TEST_F(SendCommandTest, SendCommandf_Integers_FormattedInline) {
+    manager->sendCommandf("DATA", "pin=%d;v=%u;neg=%ld;h=%x", 13, 65535u, -70000L, 255);
+
+    EXPECT_EQ(stream.output, "DATA:pin=13;v=65535;neg=-70000;h=ff\n");
+}
+
+TEST_F(SendCommandTest, SendCommandf_PaddingAndPrecision_Applied) {
+    manager->sendCommandf("DATA", "%04d|%5s|%.3s|%03d", 7, "ab", "abcdef", -5);
+
+    EXPECT_EQ(stream.output, "DATA:0007|   ab|abc|-05\n");
+}
+
+TEST_F(SendCommandTest, SendCommandf_FixedPoint_RoundsToPrecision) {
+    manager->sendCommandf("T", "%.2f;%.0f;%f;%.1f", 21.456, 2.5, 1.5, -0.04);
+
+    EXPECT_EQ(stream.output, "T:21.46;3;1.500000;-0.0\n");
+}
+
+TEST_F(SendCommandTest, SendCommandf_FlashFormatAndFlashArgument_Streamed) {
+    manager->sendCommandf("ACK", F("%s=%S%%"), "LED", F("ok"));
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok%\n");
+}
+
+TEST_F(SendCommandTest, SendCommandf_LeftAlignAndLengthModifiers_Applied) {
+    manager->sendCommandf("DATA", "%-5d|%-4s|%+d|%hd|%lld|%llx", 42, "ab", 7, 3, 123456789LL, 0xABCULL);
+
+    EXPECT_EQ(stream.output, "DATA:42   |ab  |7|3|123456789|abc\n");
+}
+
+TEST_F(SendCommandTest, SendCommandf_UnsupportedConversion_ArgumentSkipped) {
+    manager->sendCommandf("DATA", "%e|%d|%o|%s|%p|%d", 1.5, 2, 8u, "x", (void*)nullptr, 3);
+
+    EXPECT_EQ(stream.output, "DATA:%e|2|%o|x|%p|3\n");
+}
+
+TEST_F(SendCommandTest, SendCommandf_EmptyFormat_WritesHeaderOnly) {
+    manager->sendCommandf("PING", "");
+
+    EXPECT_EQ(stream.output, "PING\n");
+}
+
+TEST_F(SendCommandTest, SendErrorf_FormatsErrorMessage) {
+    manager->sendErrorf(F("Bad pin %d"), 99);
+
+    EXPECT_EQ(stream.output, "ERR:Bad pin 99\n");
+}
+
+TEST_F(SendCommandTest, SendDebugf_DebugDisabled_WritesNothing) {
+    manager->sendDebugf("value %d", 1);
+
+    EXPECT_EQ(stream.output, "");
+}
+
+// ============================================================================
+// Param Builder Tests
+// ============================================================================
+
+TEST_F(SendCommandTest, Reply_KeyValues_WrittenInline) {
+    manager->reply("ACK").kv("pin", 13).kv("state", "ON").send();
+
+    EXPECT_EQ(stream.output, "ACK:pin=13;state=ON\n");
+}
+
+TEST_F(SendCommandTest, Reply_WithMessage_ParamsFollowMessage) {
+    manager->reply(F("ACK"), "LED=ok").kv("pin", 13).kv("mode", F("blink")).send();
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok:pin=13;mode=blink\n");
+}
+
+TEST_F(SendCommandTest, Reply_NumericTypes_Formatted) {
+    manager->reply("DATA")
+        .kv("a", -32768)
+        .kv("b", 4000000000UL)
+        .kv("c", -70000L)
+        .kv("d", 3.14159, 3)
+        .kv("e", (uint8_t)255)
+        .send();
+
+    EXPECT_EQ(stream.output, "DATA:a=-32768;b=4000000000;c=-70000;d=3.142;e=255\n");
+}
+
+TEST_F(SendCommandTest, Reply_NotSent_CompletedWhenDestroyed) {
+    {
+        ParamBuilder builder = manager->reply("STATUS");
+        builder.kv("ready", 1);
+    }
+
+    EXPECT_EQ(stream.output, "STATUS:ready=1\n");
+}
+
+TEST_F(SendCommandTest, Reply_SendTwice_WritesOnce) {
+    ParamBuilder builder = manager->reply("PING");
+    builder.send();
+    builder.send();
+
+    EXPECT_EQ(stream.output, "PING\n");
+}
+
+TEST_F(SendCommandTest, Reply_EmptyHeader_WritesNothing) {
+    manager->reply("").kv("pin", 1).send();
+
+    EXPECT_EQ(stream.output, "");
+}
+
+// ============================================================================
+// Log Level Tests
+// ============================================================================
+
+class LogLevelTest : public SendCommandTest {
+};
+
+TEST_F(LogLevelTest, LogMacros_LevelsWithinModuleLevel_AreSent) {
+    SCM_LOG_ERROR(manager, LogModuleDefault, "failed", "Motor");
+    SCM_LOG_WARN(manager, LogModuleDefault, F("low voltage"));
+    SCM_LOG_INFO(manager, LogModuleDefault, "started", F("Motor"));
+
+    EXPECT_EQ(stream.output, "ERR:failed: (Motor)\nWARN:low voltage\nINFO:started: (Motor)\n");
+}
+
+TEST_F(LogLevelTest, LogMacros_DebugRequiresDebugMode) {
+    SCM_LOG_DEBUG(manager, LogModuleDefault, "hidden");
+
+    EXPECT_EQ(stream.output, "");
+}
+
+TEST_F(LogLevelTest, LogMacros_DisabledModule_ArgumentsNotEvaluated) {
+    int evaluated = 0;
+    manager->setLogLevel(2, LogLevel::None);
+
+    SCM_LOG_ERROR(manager, 2, (evaluated++, "failed"));
+
+    EXPECT_EQ(evaluated, 0);
+    EXPECT_EQ(stream.output, "");
+}
+
+TEST_F(LogLevelTest, SetLogLevel_Warn_SuppressesInfo) {
+    manager->setLogLevel(LogModuleDefault, LogLevel::Warn);
+
+    manager->sendLog(LogLevel::Info, LogModuleDefault, "info");
+    manager->sendLog(LogLevel::Warn, LogModuleDefault, "warn");
+
+    EXPECT_EQ(manager->getLogLevel(LogModuleDefault), LogLevel::Warn);
+    EXPECT_EQ(stream.output, "WARN:warn\n");
+}
+
+TEST_F(LogLevelTest, SetLogLevel_AboveCompiledLevel_Clamped) {
+    manager->setLogLevel(LogModuleDefault, LogLevel::Trace);
+
+    EXPECT_EQ(manager->getLogLevel(LogModuleDefault), (LogLevel)SCM_LOG_LEVEL);
+    EXPECT_EQ(manager->isLogEnabled(LogLevel::Trace, LogModuleDefault), SCM_LOG_LEVEL >= SCM_LOG_LEVEL_TRACE);
+}
+
+TEST_F(LogLevelTest, SetLogLevel_InvalidModule_Ignored) {
+    manager->setLogLevel(LogModuleCount, LogLevel::Trace);
+
+    EXPECT_EQ(manager->getLogLevel(LogModuleCount), LogLevel::None);
+    EXPECT_FALSE(manager->isLogEnabled(LogLevel::Error, LogModuleCount));
+}
+
+TEST_F(LogLevelTest, LibraryModule_Silenced_NoParserErrors) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    stream.input = "MOVE";
+    manager->readCommands();
+
+    manager->setLogLevel(LogModuleLibrary, LogLevel::None);
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(1000);
+    manager->readCommands();
+
+    EXPECT_TRUE(manager->isTimeout());
+    EXPECT_EQ(stream.output, "");
+}
+
+TEST_F(LogLevelTest, LibraryModule_Timeout_ReportsError) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    stream.input = "MOVE";
+    manager->readCommands();
+
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(1000);
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output, "ERR:Timeout: (SerialCommandManager)\n");
+}
+
+TEST_F(LogLevelTest, CompactErrors_Timeout_SendsCode) {
+    manager->setCompactErrors(true);
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    stream.input = "MOVE";
+    manager->readCommands();
+
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(1000);
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output, "ERR:6\n");
+}
+
+TEST_F(LogLevelTest, CompactErrors_ParamValueTooLong_SendsCode) {
+    manager->setCompactErrors(true);
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    stream.input = "LED:v=" + std::string(DefaultMaxParamValueLength + 1, 'x') + "\n";
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output.substr(0, 6), "ERR:4\n");
+}
+
+TEST_F(LogLevelTest, GetErrorText_ReturnsCatalogueText) {
+    EXPECT_STREQ(reinterpret_cast<const char*>(SerialCommandManager::getErrorText(ErrorCode::Timeout)), "Timeout");
+    EXPECT_STREQ(reinterpret_cast<const char*>(SerialCommandManager::getErrorText(ErrorCode::RawBufferFull)), "Raw buffer full");
+    EXPECT_EQ(SerialCommandManager::getErrorText(ErrorCode::None), nullptr);
+}
+
+// ============================================================================
+// Rate Limit Tests
+// ============================================================================
+
+class RateLimitTest : public SendCommandTest {
+};
+
+TEST_F(RateLimitTest, RateLimit_BurstExceeded_SuppressesAndSummarises) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    manager->setRateLimit(LogLevel::Error, 2, 1000);
+
+    for (int i = 0; i < 5; ++i)
+        manager->sendError(F("Timeout"), F("Mgr"));
+
+    EXPECT_EQ(stream.output, "ERR:Timeout: (Mgr)\nERR:Timeout: (Mgr)\n");
+    EXPECT_EQ(manager->getSuppressedCount(LogLevel::Error), 3);
+
+    stream.output.clear();
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(1000);
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "ERR:Timeout x3 suppressed\n");
+    EXPECT_EQ(manager->getSuppressedCount(LogLevel::Error), 0);
+}
+
+TEST_F(RateLimitTest, RateLimit_TokensRefillOverTime) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    manager->setRateLimit(LogLevel::Error, 1, 100);
+
+    manager->sendError("first");
+    manager->sendError("suppressed");
+
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(150);
+    manager->sendError("second");
+
+    EXPECT_EQ(stream.output, "ERR:first\nERR:second\n");
+}
+
+TEST_F(RateLimitTest, Sampling_OneInN_SendsFirstOfEachGroup) {
+    manager->setSampling(LogLevel::Error, 3);
+
+    for (int i = 0; i < 7; ++i)
+        manager->sendErrorf("e%d", i);
+
+    EXPECT_EQ(stream.output, "ERR:e0\nERR:e3\nERR:e6\n");
+    EXPECT_EQ(manager->getSuppressedCount(LogLevel::Error), 4);
+}
+
+TEST_F(RateLimitTest, RateLimit_ErrorsLimited_CommandsUnaffected) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    manager->setRateLimit(LogLevel::Error, 1, 1000);
+
+    manager->sendError("one");
+    manager->sendError("two");
+    manager->sendCommand("ACK", "X=ok");
+
+    EXPECT_EQ(stream.output, "ERR:one\nACK:X=ok\n");
+}
+
+// ============================================================================
+// Log Buffer Tests
+// ============================================================================
+
+class LogBufferTest : public SendCommandTest {
+protected:
+    void SetUp() override {
+        SendCommandTest::SetUp();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(42);
+    }
+};
+
+TEST_F(LogBufferTest, LogBuffer_Enabled_CapturesDebugWithoutSending) {
+    ASSERT_TRUE(manager->setLogBuffer(4));
+
+    manager->sendDebug(F("Motor stopped"), F("Motor"));
+    manager->sendDebug("a long RAM message");
+    manager->sendError("sent live");
+
+    EXPECT_EQ(manager->getLogBufferCount(), 2);
+    EXPECT_EQ(stream.output, "ERR:sent live\n");
+}
+
+TEST_F(LogBufferTest, DumpLogBuffer_WritesRecordsOldestFirst) {
+    ASSERT_TRUE(manager->setLogBuffer(4));
+    manager->sendDebug(F("Motor stopped"), F("Motor"));
+    manager->sendDebug("a long RAM message");
+
+    manager->dumpLogBuffer();
+
+    EXPECT_EQ(stream.output, "LOG:t=42;l=D;m=Motor stopped;id=Motor\nLOG:t=42;l=D;m=a long RAM me\n");
+}
+
+TEST_F(LogBufferTest, LogBuffer_Full_KeepsMostRecent) {
+    ASSERT_TRUE(manager->setLogBuffer(2));
+
+    manager->sendDebug("one");
+    manager->sendDebug("two");
+    manager->sendDebug("three");
+    manager->dumpLogBuffer();
+
+    EXPECT_EQ(stream.output, "LOG:t=42;l=D;m=two\nLOG:t=42;l=D;m=three\n");
+}
+
+TEST_F(LogBufferTest, LogCommand_DumpsAndAcknowledges) {
+    ASSERT_TRUE(manager->setLogBuffer(2));
+    manager->sendDebug("one");
+
+    stream.input = "LOG\n";
+    manager->readCommands();
+
+    // The library's raw message debug output is captured as well
+    EXPECT_EQ(stream.output, "LOG:t=42;l=D;m=one\nLOG:t=42;l=D;m=LOG;id=SerialComdMgr-RawMessage:\nACK:LOG=ok\n");
+}
+
+TEST_F(LogBufferTest, LogCommand_Clear_EmptiesBuffer) {
+    ASSERT_TRUE(manager->setLogBuffer(2));
+    manager->sendDebug("one");
+
+    stream.input = "LOG:CLEAR\n";
+    manager->readCommands();
+
+    EXPECT_EQ(manager->getLogBufferCount(), 0);
+    EXPECT_EQ(stream.output, "ACK:LOG=ok\n");
+}
+
+// An application command named LOG, reachable while the log buffer is off
+class AppLogHandler : public ISerialCommandHandler {
+public:
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t paramCount) override {
+        sender->sendAck(command, "app");
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "LOG" };
+        count = 1;
+        return cmds;
+    }
+};
+
+TEST_F(LogBufferTest, LogCommand_BufferDisabled_PassedToApplication) {
+    AppLogHandler handler;
+    ISerialCommandHandler* handlers[] = { &handler };
+    manager->registerHandlers(handlers, 1);
+
+    stream.input = "LOG\n";
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "ACK:LOG=app\n");
+
+    // Once the buffer is enabled the built in command takes LOG
+    ASSERT_TRUE(manager->setLogBuffer(2));
+    stream.output.clear();
+    stream.input += "LOG:CLEAR\n";
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "ACK:LOG=ok\n");
+}
+
+// ============================================================================
+// Transmit Buffer Tests
+// ============================================================================
+
+class TxBufferTest : public SendCommandTest {
+};
+
+TEST_F(TxBufferTest, TxBuffer_PortFull_QueuesUntilPoll) {
+    ASSERT_TRUE(manager->setTxBuffer(64));
+    stream.writeRoom = 0;
+
+    manager->sendCommand("ACK", "LED=ok");
+
+    EXPECT_EQ(stream.output, "");
+    EXPECT_EQ(manager->getTxPending(), 11);
+
+    stream.writeRoom = 64;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok\n");
+    EXPECT_EQ(manager->getTxPending(), 0);
+}
+
+TEST_F(TxBufferTest, TxBuffer_Poll_WritesOnlyAvailableForWrite) {
+    ASSERT_TRUE(manager->setTxBuffer(64));
+    stream.writeRoom = 0;
+    manager->sendCommand("ACK", "LED=ok");
+
+    stream.writeRoom = 4;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "ACK:");
+    EXPECT_EQ(manager->getTxPending(), 7);
+}
+
+TEST_F(TxBufferTest, TxBuffer_WrapsAround_PreservesOrder) {
+    ASSERT_TRUE(manager->setTxBuffer(16));
+
+    for (int i = 0; i < 5; ++i)
+        manager->sendCommand("ACK", "LED=ok");
+
+    manager->poll();
+
+    std::string expected;
+    for (int i = 0; i < 5; ++i)
+        expected += "ACK:LED=ok\n";
+
+    EXPECT_EQ(stream.output, expected);
+}
+
+TEST_F(TxBufferTest, TxBuffer_ReportPolicy_DropsWholeMessageAndReports) {
+    ASSERT_TRUE(manager->setTxBuffer(48, TxOverflowPolicy::Report));
+    stream.writeRoom = 0;
+
+    manager->sendCommand("DATA", "0123456789012345678901234567890");
+    manager->sendCommand("DATA", "this message does not fit");
+
+    EXPECT_EQ(manager->getTxDropped(), 1);
+    EXPECT_EQ(manager->getTxPending(), 37);
+
+    stream.writeRoom = 128;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "DATA:0123456789012345678901234567890\nERR:TX overflow:dropped=1\n");
+}
+
+TEST_F(TxBufferTest, TxBuffer_ReportPolicy_CompactErrors_ReportsCode) {
+    ASSERT_TRUE(manager->setTxBuffer(48, TxOverflowPolicy::Report));
+    manager->setCompactErrors(true);
+    stream.writeRoom = 0;
+
+    manager->sendCommand("DATA", "0123456789012345678901234567890");
+    manager->sendCommand("DATA", "this message does not fit");
+
+    stream.writeRoom = 128;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "DATA:0123456789012345678901234567890\nERR:7:dropped=1\n");
+}
+
+TEST_F(TxBufferTest, TxBuffer_ReportPolicy_BufferTooSmallForReport_Rejected) {
+    static char storage[TxOverflowReportLength - 1];
+
+    EXPECT_FALSE(manager->setTxBuffer(TxOverflowReportLength - 1, TxOverflowPolicy::Report));
+    EXPECT_FALSE(manager->setTxBuffer(storage, sizeof(storage), TxOverflowPolicy::Report));
+    EXPECT_TRUE(manager->setTxBuffer(sizeof(storage), TxOverflowPolicy::DropDebug));
+
+    // The smallest Report buffer still has room for the report once drained
+    ASSERT_TRUE(manager->setTxBuffer(TxOverflowReportLength, TxOverflowPolicy::Report));
+    stream.writeRoom = 0;
+
+    manager->sendCommand("DATA", "0123456789");
+    manager->sendCommand("DATA", "0123456789012345678901234567890");
+
+    stream.writeRoom = 128;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "DATA:0123456789\nERR:TX overflow:dropped=1\n");
+}
+
+TEST_F(TxBufferTest, Batching_NoTxBuffer_ReturnsFalse) {
+    EXPECT_FALSE(manager->setBatching(20));
+}
+
+TEST_F(TxBufferTest, Batching_HoldsMessagesUntilDeadline) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(100);
+    ASSERT_TRUE(manager->setTxBuffer(128));
+    ASSERT_TRUE(manager->setBatching(20));
+
+    manager->sendCommand("T", "1");
+    manager->sendCommand("T", "2");
+    manager->sendCommand("T", "3");
+
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(119);
+    manager->poll();
+    EXPECT_EQ(stream.output, "");
+
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(120);
+    manager->poll();
+    EXPECT_EQ(stream.output, "T:1\nT:2\nT:3\n");
+    EXPECT_EQ(stream.writeCount, 1);
+}
+
+TEST_F(TxBufferTest, Batching_BufferThreeQuartersFull_Sends) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    ASSERT_TRUE(manager->setTxBuffer(32));
+    ASSERT_TRUE(manager->setBatching(1000));
+
+    manager->sendCommand("DATA", "0123456789");
+    manager->poll();
+    EXPECT_EQ(stream.output, "");
+
+    manager->sendCommand("DATA", "0123");
+    manager->poll();
+    EXPECT_EQ(stream.output, "DATA:0123456789\nDATA:0123\n");
+}
+
+TEST_F(TxBufferTest, Batching_ErrorSendsBatchInOrder) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    ASSERT_TRUE(manager->setTxBuffer(128));
+    ASSERT_TRUE(manager->setBatching(1000));
+
+    manager->sendCommand("T", "1");
+    manager->sendError("bad", "");
+
+    EXPECT_EQ(stream.output, "T:1\nERR:bad\n");
+}
+
+TEST_F(TxBufferTest, Batching_AckSendsBatchInOrder) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    ASSERT_TRUE(manager->setTxBuffer(128));
+    ASSERT_TRUE(manager->setBatching(1000));
+
+    manager->sendCommand("T", "1");
+    manager->sendAck("LED", "ok");
+
+    EXPECT_EQ(stream.output, "T:1\nACK:LED=ok\n");
+}
+
+TEST_F(TxBufferTest, Batching_Flush_SendsRemainderOnLaterPolls) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    ASSERT_TRUE(manager->setTxBuffer(128));
+    ASSERT_TRUE(manager->setBatching(1000));
+
+    manager->sendCommand("T", "1");
+    manager->sendCommand("T", "2");
+    stream.writeRoom = 4;
+    manager->flush();
+    EXPECT_EQ(stream.output, "T:1\n");
+
+    stream.writeRoom = 64;
+    manager->poll();
+    EXPECT_EQ(stream.output, "T:1\nT:2\n");
+}
+
+TEST_F(TxBufferTest, TxBuffer_BlockPolicy_NoMessagesLost) {
+    ASSERT_TRUE(manager->setTxBuffer(8, TxOverflowPolicy::Block));
+    stream.writeRoom = 0;
+
+    manager->sendCommand("DATA", "a message longer than the buffer");
+
+    stream.writeRoom = 64;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "DATA:a message longer than the buffer\n");
+    EXPECT_EQ(manager->getTxDropped(), 0);
+}
+
+TEST_F(TxBufferTest, TxBuffer_DropDebugPolicy_DropsDebugKeepsCommands) {
+    When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    ASSERT_TRUE(manager->setTxBuffer(40, TxOverflowPolicy::DropDebug));
+    stream.writeRoom = 0;
+    stream.input = "DEBUG:ON\n";
+    manager->readCommands();
+
+    // "DEBUG:ON\n" is queued, fill to 3/4 of the buffer
+    manager->sendCommand("DATA", "0123456789abcde");
+    manager->sendDebug("dropped", "Test");
+    manager->sendCommand("ACK", "X=ok");
+
+    EXPECT_EQ(manager->getTxDropped(), 1);
+
+    stream.writeRoom = 128;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "DEBUG:ON\nDATA:0123456789abcde\nACK:X=ok\n");
+}
+
+TEST_F(TxBufferTest, TxBuffer_DropDebugPolicy_CommandDoesNotFit_DroppedWithoutBlocking) {
+    ASSERT_TRUE(manager->setTxBuffer(32, TxOverflowPolicy::DropDebug));
+    stream.writeRoom = 0;
+
+    manager->sendCommand("DATA", "0123456789abcdef");
+    manager->sendCommand("DATA", "0123456789abcdef");
+
+    // Nothing is forced onto a port with no room, the second message is dropped and counted
+    EXPECT_EQ(stream.writeCount, 0);
+    EXPECT_EQ(manager->getTxDropped(), 1);
+    EXPECT_EQ(manager->getTxPending(), 22);
+
+    stream.writeRoom = 128;
+    manager->poll();
+
+    EXPECT_EQ(stream.output, "DATA:0123456789abcdef\n");
+}
+
+TEST_F(TxBufferTest, TxBuffer_Disable_FlushesPendingOutput) {
+    ASSERT_TRUE(manager->setTxBuffer(64));
+    stream.writeRoom = 0;
+    manager->sendCommand("ACK", "LED=ok");
+
+    ASSERT_TRUE(manager->setTxBuffer(0));
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok\n");
+    EXPECT_EQ(manager->getTxPending(), 0);
+}
+
+// ============================================================================
+// Registry Tests
+// ============================================================================
+
+static SimpleTestHandler s_registryHandler;
+static ISerialCommandHandler* const s_registryHandlers[] = { &s_registryHandler };
+static constexpr SerialCommandRegistry s_registry(s_registryHandlers);
+
+class RegistryTest : public SendCommandTest {
+protected:
+    void SetUp() override {
+        SendCommandTest::SetUp();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+        s_registryHandler.wasCalled = false;
+    }
+};
+
+TEST_F(RegistryTest, Registry_ConstantExpression_CountsHandlers) {
+    EXPECT_EQ(s_registry.getHandlerCount(), 1u);
+    EXPECT_EQ(s_registry.getHandler(0), &s_registryHandler);
+    EXPECT_EQ(s_registry.getHandler(1), nullptr);
+}
+
+TEST_F(RegistryTest, SetRegistry_SharedByManagers_DispatchesOnEach) {
+    CaptureStream otherStream;
+    SerialCommandManager other(&otherStream, nullptr);
+    manager->setRegistry(&s_registry);
+    other.setRegistry(&s_registry);
+
+    otherStream.input = "PING\n";
+    other.readCommands();
+    EXPECT_TRUE(s_registryHandler.wasCalled);
+
+    s_registryHandler.wasCalled = false;
+    stream.input = "ECHO\n";
+    manager->readCommands();
+    EXPECT_TRUE(s_registryHandler.wasCalled);
+    EXPECT_STREQ(s_registryHandler.lastCommand, "ECHO");
+}
+
+TEST_F(RegistryTest, SetRegistry_Null_InternalHandlersStillAvailable) {
+    manager->setRegistry(nullptr);
+    stream.input = "DEBUG:ON\n";
+
+    manager->readCommands();
+
+    EXPECT_EQ(manager->getRegistry(), nullptr);
+    EXPECT_NE(stream.output.find("DEBUG:ON"), std::string::npos);
+}
+
+TEST_F(RegistryTest, RegisterHandlers_CopiesLocalArray) {
+    {
+        ISerialCommandHandler* handlers[] = { &s_registryHandler };
+        manager->registerHandlers(handlers, 1);
+    }
+
+    stream.input = "TEST\n";
+    manager->readCommands();
+
+    EXPECT_TRUE(s_registryHandler.wasCalled);
+    EXPECT_EQ(manager->getRegistry()->getHandlerCount(), 1u);
+}
+
+// ============================================================================
+// Correlation Id Tests
+// ============================================================================
+
+class AckingHandler : public ISerialCommandHandler {
+public:
+    uint8_t paramCount = 0;
+    std::string firstKey;
+    std::string correlationId;
+
+    bool handleCommand(SerialCommandManager* sender, const char* command,
+                       const StringKeyValue params[], uint8_t count) override {
+        paramCount = count;
+        firstKey = count > 0 ? params[0].key : "";
+        correlationId = sender->getCorrelationId();
+        sender->sendAck(command, "ok", params, count);
+        return true;
+    }
+
+    const char* const* supportedCommands(size_t& count) const override {
+        static const char* cmds[] = { "LED" };
+        count = 1;
+        return cmds;
+    }
+};
+
+class CorrelationIdTest : public SendCommandTest {
+protected:
+    void SetUp() override {
+        SendCommandTest::SetUp();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+        ISerialCommandHandler* handlers[] = { &handler };
+        manager->registerHandlers(handlers, 1);
+    }
+
+    AckingHandler handler;
+};
+
+TEST_F(CorrelationIdTest, Parse_IdRemovedFromParams) {
+    stream.input = "LED:#=42;pin=13\n";
+    manager->readCommands();
+
+    EXPECT_EQ(handler.correlationId, "42");
+    EXPECT_EQ(handler.paramCount, 1);
+    EXPECT_EQ(handler.firstKey, "pin");
+}
+
+TEST_F(CorrelationIdTest, SendAck_WhileHandling_EchoesId) {
+    stream.input = "LED:pin=13;#=7\n";
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok:#=7;pin=13\n");
+}
+
+TEST_F(CorrelationIdTest, SendAck_NoParams_EchoesId) {
+    stream.input = "LED:#=7\n";
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output, "ACK:LED=ok:#=7\n");
+}
+
+TEST_F(CorrelationIdTest, SendAck_AfterHandling_NoId) {
+    stream.input = "LED:#=7\n";
+    manager->readCommands();
+    stream.output.clear();
+
+    manager->sendAck("LED", "done");
+
+    EXPECT_STREQ(manager->getCorrelationId(), "");
+    EXPECT_EQ(stream.output, "ACK:LED=done\n");
+}
+
+TEST_F(CorrelationIdTest, Parse_NoId_Empty) {
+    stream.input = "LED:pin=13\n";
+    manager->readCommands();
+
+    EXPECT_EQ(handler.correlationId, "");
+    EXPECT_EQ(stream.output, "ACK:LED=ok:pin=13\n");
+}
+
+// ============================================================================
+// Flow Control Tests
+// ============================================================================
+
+class FlowControlTest : public SendCommandTest {
+protected:
+    void SetUp() override {
+        SendCommandTest::SetUp();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    }
+};
+
+TEST_F(FlowControlTest, Credit_Enabled_AdvertisesWindow) {
+    manager->setFlowControl(FlowControl::Credit, 4);
+
+    EXPECT_EQ(stream.output, "CREDIT:window=4\n");
+}
+
+TEST_F(FlowControlTest, Credit_MessagesRead_GrantsCoalescedUntilIdle) {
+    manager->setFlowControl(FlowControl::Credit, 4);
+    stream.output.clear();
+    stream.input = "A\nB\nC\n";
+
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "");
+
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "CREDIT:2\n");
+
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "CREDIT:2\nCREDIT:1\n");
+}
+
+TEST_F(FlowControlTest, Credit_Request_ReadvertisesWindow) {
+    manager->setFlowControl(FlowControl::Credit, 4);
+    stream.output.clear();
+    stream.input = "CREDIT\n";
+
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output, "CREDIT:window=4\n");
+}
+
+TEST_F(FlowControlTest, Credit_Sender_SpendsGrantedCredits) {
+    manager->setFlowControl(FlowControl::Credit);
+    EXPECT_EQ(stream.output, "CREDIT\n");
+    EXPECT_FALSE(manager->canSend());
+
+    stream.input = "CREDIT:window=2\n";
+    manager->readCommands();
+    EXPECT_EQ(manager->getCredits(), 2);
+
+    manager->sendCommand("LED", "on");
+    manager->sendCommand("LED", "off");
+    EXPECT_FALSE(manager->canSend());
+
+    stream.input += "CREDIT:1\n";
+    manager->readCommands();
+    EXPECT_EQ(manager->getCredits(), 1);
+    EXPECT_TRUE(manager->canSend());
+}
+
+TEST_F(FlowControlTest, Credit_CreditFrames_NeitherEarnNorSpendCredits) {
+    manager->setFlowControl(FlowControl::Credit, 4);
+    stream.output.clear();
+    stream.input = "CREDIT:3\n";
+
+    // A grant from the peer is not answered with a grant of our own
+    manager->readCommands();
+    manager->readCommands();
+    EXPECT_EQ(manager->getCredits(), 3);
+    EXPECT_EQ(stream.output, "");
+
+    // Granting a slot back does not use up one of the peer's credits
+    stream.input += "A\n";
+    manager->readCommands();
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "CREDIT:1\n");
+    EXPECT_EQ(manager->getCredits(), 3);
+}
+
+TEST_F(FlowControlTest, XonXoff_ReceiveBufferFilling_SendsXoffThenXon) {
+    manager->setFlowControl(FlowControl::XonXoff, 8);
+    stream.input = "A\nBBBBBB\n";
+
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "\x13");
+
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "\x13\x11");
+}
+
+TEST_F(FlowControlTest, XonXoff_BufferFullBeforeRead_SendsXoffBeforeReply) {
+    manager->setFlowControl(FlowControl::XonXoff, 8);
+    stream.input = "DEBUG\nBBB\n";
+
+    manager->readCommands();
+
+    EXPECT_EQ(stream.output, "\x13" "DEBUG:OFF\n");
+}
+
+TEST_F(FlowControlTest, XonXoff_PeerXoff_HoldsQueuedOutput) {
+    manager->setTxBuffer(64);
+    manager->setFlowControl(FlowControl::XonXoff);
+    stream.input = "\x13";
+    manager->readCommands();
+
+    manager->sendCommand("LED", "on");
+    manager->poll();
+    EXPECT_FALSE(manager->canSend());
+    EXPECT_EQ(stream.output, "");
+
+    stream.input += "\x11";
+    manager->readCommands();
+    EXPECT_TRUE(manager->canSend());
+    EXPECT_EQ(stream.output, "LED:on\n");
+}
+
+TEST_F(FlowControlTest, XonXoff_PeerXoff_FullBufferNotForcedOut) {
+    manager->setTxBuffer(32, TxOverflowPolicy::Block);
+    manager->setFlowControl(FlowControl::XonXoff);
+    stream.input = "\x13";
+    manager->readCommands();
+
+    for (int i = 0; i < 6; i++)
+        manager->sendCommand("LED", "on");
+
+    EXPECT_EQ(stream.output, "");
+    EXPECT_EQ(manager->getTxPending(), 28);
+    EXPECT_EQ(manager->getTxDropped(), 2);
+
+    stream.input += "\x11";
+    manager->readCommands();
+    EXPECT_EQ(stream.output, "LED:on\nLED:on\nLED:on\nLED:on\n");
+}
+
+// ============================================================================
+// Caller Storage Tests
+// ============================================================================
+
+class StorageTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoFakeReset();
+        When(Method(ArduinoFake(), millis)).AlwaysReturn(0);
+    }
+
+    CaptureStream stream;
+    uint8_t storage[SerialCommandManager::storageSize()];
+    ISerialCommandHandler* handlerSlots[2];
+};
+
+TEST_F(StorageTest, StorageSize_CoversAllMessageBuffers) {
+    EXPECT_EQ(SerialCommandManager::storageSize(20, 128), 21u + 129u);
+}
+
+TEST_F(StorageTest, CallerStorage_ParsesIntoStorage) {
+    SerialCommandManager manager(&stream, nullptr, storage, sizeof(storage), handlerSlots, 2);
+    SimpleTestHandler handler;
+    ISerialCommandHandler* handlers[] = { &handler };
+    manager.registerHandlers(handlers, 1);
+
+    stream.input = "PING:pin=13\n";
+    manager.readCommands();
+
+    EXPECT_TRUE(handler.wasCalled);
+    EXPECT_EQ(handlerSlots[0], &handler);
+    EXPECT_GE((const uint8_t*)manager.getRawMessage(), storage);
+    EXPECT_LT((const uint8_t*)manager.getRawMessage(), storage + sizeof(storage));
+}
+
+TEST_F(StorageTest, CallerStorage_MoreHandlersThanSlots_RegistersSlotCount) {
+    SerialCommandManager manager(&stream, nullptr, storage, sizeof(storage), handlerSlots, 1);
+    SimpleTestHandler first, second;
+    ISerialCommandHandler* handlers[] = { &first, &second };
+
+    manager.registerHandlers(handlers, 2);
+
+    EXPECT_EQ(manager.getRegistry()->getHandlerCount(), 1u);
+}
+
+TEST_F(StorageTest, CallerStorage_SmallStorage_ReducesMessageLength) {
+    SerialCommandManager manager(&stream, nullptr, storage, SerialCommandManager::storageSize(20, 8));
+
+    stream.input = "LED:pin=13\n";
+    manager.readCommands();
+
+    EXPECT_EQ(stream.output, "ERR:Raw buffer full: (SerialCommandManager)\n");
+}
+
+TEST_F(StorageTest, CallerStorage_BelowMinimum_OnlySends) {
+    for (size_t size = 0; size < MinimumStorageSize; size++) {
+        memset(storage, 0xAA, sizeof(storage));
+        stream.input = "LED:pin=13\n";
+        stream.readPos = 0;
+        stream.output.clear();
+
+        SerialCommandManager manager(&stream, nullptr, storage, size);
+        manager.readCommands();
+        manager.sendCommand("ACK", "ok");
+
+        EXPECT_EQ(stream.readPos, 0u) << size;
+        EXPECT_STREQ(manager.getCommand(), "") << size;
+        EXPECT_EQ(stream.output, "ACK:ok\n") << size;
+
+        for (size_t i = 0; i < sizeof(storage); i++)
+            ASSERT_EQ(storage[i], 0xAA) << "size " << size << " byte " << i;
+    }
+}
+
+TEST_F(StorageTest, CallerStorage_Minimum_ReadsWithinStorage) {
+    memset(storage, 0xAA, sizeof(storage));
+    stream.input = "LED:pin=13\n";
+
+    SerialCommandManager manager(&stream, nullptr, storage, MinimumStorageSize);
+    while (stream.available() > 0)
+        manager.readCommands();
+
+    EXPECT_EQ(stream.output.find("ERR:Raw buffer full: (SerialCommandManager)\n"), 0u) << stream.output;
+
+    for (size_t i = MinimumStorageSize; i < sizeof(storage); i++)
+        ASSERT_EQ(storage[i], 0xAA) << "byte " << i;
+}
+
+TEST_F(StorageTest, CallerStorage_LongCommand_TruncatedRawMessageKept) {
+    SerialCommandManager manager(&stream, nullptr, storage, SerialCommandManager::storageSize(4, 32), nullptr, 0,
+        '\n', ':', ';', '=', 500, 4, 32);
+
+    stream.input = "PINGPONG:a=1;b=2\n";
+    manager.readCommands();
+
+    EXPECT_STREQ(manager.getCommand(), "PING");
+    EXPECT_STREQ(manager.getRawMessage(), "PINGPONG:a=1;b=2\n");
+    ASSERT_EQ(manager.getArgCount(), 2);
+    EXPECT_STREQ(manager.getArgs(1)->value, "2");
+}
+
+TEST_F(StorageTest, CallerStorage_TxAndLogBuffers_UsedWithoutAllocating) {
+    SerialCommandManager manager(&stream, nullptr, storage, sizeof(storage));
+    char txBuffer[32];
+    alignas(void*) uint8_t logStorage[SerialCommandManager::logBufferSize(3)];
+
+    ASSERT_TRUE(manager.setTxBuffer(txBuffer, sizeof(txBuffer)));
+    ASSERT_TRUE(manager.setLogBuffer(logStorage, sizeof(logStorage)));
+    EXPECT_EQ(manager.getLogBufferSize(), 3);
+
+    stream.writeRoom = 0;
+    manager.sendCommand("LED", "on");
+    EXPECT_EQ(manager.getTxPending(), 7);
+    EXPECT_EQ(std::string(txBuffer, 7), "LED:on\n");
+
+    stream.writeRoom = 64;
+    manager.poll();
+    EXPECT_EQ(stream.output, "LED:on\n");
+}
+
 // ============================================================================
 // Run all tests
 // ============================================================================